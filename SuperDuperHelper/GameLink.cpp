@@ -1,178 +1,367 @@
 #include "GameLink.h"
+#include "GameLinkShared.h"
+#include "GameLinkPlatform.h"
 
 #include <vector>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+using namespace GameLink;
+using GameLinkPlatform::LockResult;
 
 //------------------------------------------------------------------------------
-// Local Definitions
+// Local Data
 //------------------------------------------------------------------------------
 
-#define SYSTEM_NAME		"AppleWin"
-#define PROTOCOL_VER		4
-#define GAMELINK_MUTEX_NAME		"DWD_GAMELINK_MUTEX_R4"
-#define GAMELINK_MMAP_NAME		"DWD_GAMELINK_MMAP_R4"
+static sSharedMemoryMap_R4* g_p_shared_memory;
 
-using namespace GameLink;
+constexpr int MEMORY_MAP_CORE_SIZE = sizeof(sSharedMemoryMap_R4);
+static UINT8* ramPointer;
 
-//------------------------------------------------------------------------------
-// Shared Memory Structure
-//------------------------------------------------------------------------------
+// Serializes our own writers to buf_tohost, so that no two threads see it empty and both fill it.
+// It also keeps the helper the ring's single producer.
+static std::mutex g_tohost_lock;
+
+// The server's command ring, if it has one (protocol v5)
+static sSharedMMapRing_R5* g_ring;
+
+// The server's lock-free frame buffers, if it has them (protocol v6)
+static sSharedMMapFrames_R6* g_frames;
 
-#pragma pack( push, 1 )
-
-	//
-	// sSharedMMapFrame_R1
-	//
-	// Server -> Client Frame. 32-bit RGBA up to MAX_WIDTH x MAX_HEIGHT
-	//
-struct sSharedMMapFrame_R1
-{
-	UINT16 seq;
-	UINT16 width;
-	UINT16 height;
-
-	UINT8 image_fmt; // 0 = no frame; 1 = 32-bit 0xAARRGGBB
-	UINT8 reserved0;
-
-	UINT16 par_x; // pixel aspect ratio
-	UINT16 par_y;
-
-	enum { MAX_WIDTH = 1280 };
-	enum { MAX_HEIGHT = 1024 };
-
-	enum { MAX_PAYLOAD = (int)MAX_WIDTH * (int)MAX_HEIGHT * 4 };
-	UINT8 buffer[MAX_PAYLOAD];
-};
-
-//
-// sSharedMMapInput_R2
-//
-// Client -> Server Input Data
-//
-
-struct sSharedMMapInput_R2
-{
-	float mouse_dx;
-	float mouse_dy;
-	UINT8 ready;
-	UINT8 mouse_btn;
-	UINT keyb_state[8];
-
-	enum { READY_NO = 0 };					// Input not ready
-	enum { READY_GC = 1 };					// Input from GC
-	enum { READY_OTHER = 17 };				// Input from other app
-};
-
-//
-// sSharedMMapPeek_R2
-//
-// Memory reading interface, an obsolete way of requesting RAM address values.
-// This is unnecessary now for reading RAM as the RAM is completely mapped at the end of the SHM
-// However we can use this interface to request processor registers!
-struct sSharedMMapPeek_R2
-{
-	enum { PEEK_SPECIAL_PC_H = UINT_MAX - 1 };	// Set this address to request program counter high byte
-	enum { PEEK_SPECIAL_PC_L = UINT_MAX - 2 };	// Set this address to request program counter low byte
-	enum { PEEK_LIMIT = 16 * 1024 };
-
-	UINT addr_count;
-	UINT addr[PEEK_LIMIT];
-	UINT8 data[PEEK_LIMIT];
-};
-
-//
-// sSharedMMapBuffer_R1
-//
-// General buffer (64Kb)
-//
-struct sSharedMMapBuffer_R1
-{
-	enum { BUFFER_SIZE = (64 * 1024) };
-
-	UINT16 payload;
-	UINT8 data[BUFFER_SIZE];
-};
-
-//
-// sSharedMMapAudio_R1
-//
-// Audio control interface.
-//
-struct sSharedMMapAudio_R1
-{
-	UINT8 master_vol_l;
-	UINT8 master_vol_r;
-};
-
-//
-// sSharedMemoryMap_R4
-//
-// Memory Map (top-level object)
-//
-
-constexpr int FLAG_WANT_KEYB = 1 << 0;
-constexpr int FLAG_WANT_MOUSE = 1 << 1;
-constexpr int FLAG_NO_FRAME = 1 << 2;
-constexpr int FLAG_PAUSED = 1 << 3;
-constexpr int SYSTEM_MAXLEN = 64;
-constexpr int PROGRAM_MAXLEN = 260;
-
-struct sSharedMemoryMap_R4
-{
-	UINT8 version; // = PROTOCOL_VER
-	UINT8 flags;
-	char system[SYSTEM_MAXLEN] = {}; // System name.
-	char program[PROGRAM_MAXLEN] = {}; // Program name. Zero terminated.
-	UINT program_hash[4] = { 0,0,0,0 }; // Program code hash (256-bits)
-
-	sSharedMMapFrame_R1 frame;
-	sSharedMMapInput_R2 input;
-	sSharedMMapPeek_R2 peek;
-	sSharedMMapBuffer_R1 buf_tohost;
-	sSharedMMapBuffer_R1 buf_recv; // a message to us.
-	sSharedMMapAudio_R1 audio;
-
-	// added for protocol v4
-	UINT ram_size;
-
-	// added a simpler, other input channel that isn't clobbered by gridcarto
-	sSharedMMapInput_R2 input_other;
-};
-
-#pragma pack( pop )
+// Bumped whenever the emulator's SDHR state may have been thrown away
+static std::atomic<UINT32> g_sdhr_generation = 0;
 
 //------------------------------------------------------------------------------
-// Local Data
+// Messages to the host
 //------------------------------------------------------------------------------
 
-static HANDLE g_mutex_handle;
-static HANDLE g_mmap_handle;
+// The command ring the server advertises, once checked against what's actually mapped
+static sSharedMMapRing_R5* FindRing()
+{
+	if (g_p_shared_memory->version < PROTOCOL_VER_RING)
+		return NULL;
+	const size_t offset = sSharedMMapRing_R5::OffsetFor(g_p_shared_memory->ram_size);
+	const size_t mapped = GameLinkPlatform::GetSharedMemorySize();
+	if (mapped < offset + sSharedMMapRing_R5::SizeFor(1))
+		return NULL;
+	auto ring = reinterpret_cast<sSharedMMapRing_R5*>(reinterpret_cast<UINT8*>(g_p_shared_memory) + offset);
+	const UINT32 slots = ring->slot_count;
+	if (ring->magic != sSharedMMapRing_R5::MAGIC || ring->slot_size != sizeof(sSharedMMapRing_R5::Slot)
+		|| slots == 0 || (slots & (slots - 1)) != 0 || mapped < offset + sSharedMMapRing_R5::SizeFor(slots))
+	{
+		OutputDebugStringW(L"WARNING: The shared memory's command ring isn't valid, using the single buffer!\n");
+		return NULL;
+	}
+	return ring;
+}
+
+// Spins between MIN_SPINS and MAX_SPINS before blocking: more while spinning pays off, fewer while it doesn't
+constexpr UINT32 MIN_SPINS = 64;
+constexpr UINT32 MAX_SPINS = 16384;
+static UINT32 g_spin_limit = 1024;
 
-static bool g_TrackOnly;
+// Longest nap between looks at buf_tohost, which nothing signals
+constexpr UINT32 MAX_POLL_US = 2000;
 
-static sSharedMemoryMap_R4* g_p_shared_memory;
+static std::atomic<UINT32> g_write_timeout_ms = 3000;
 
-constexpr int MEMORY_MAP_CORE_SIZE = sizeof(sSharedMemoryMap_R4);
-static UINT8* ramPointer;
+static std::mutex g_write_stats_lock;
+static sWriteStats g_write_stats;
+
+// Waits for has_room() to hold, or the write timeout to pass. Called with g_tohost_lock held.
+// It spins a little first, as the emulator usually drains within microseconds. Then with a ring
+// it blocks until the server signals it's drained some, and without one it naps for longer each time.
+template <typename HasRoom>
+static WriteResult WaitForRoom(HasRoom has_room)
+{
+	if (has_room())
+	{
+		std::lock_guard<std::mutex> guard(g_write_stats_lock);
+		g_write_stats.writes++;
+		return WriteResult::OK;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = start + std::chrono::milliseconds(g_write_timeout_ms.load(std::memory_order_relaxed));
+	bool ready = false;
+	bool spun = false;
+	for (UINT32 i = 0; i < g_spin_limit && !ready; i++)
+	{
+		GameLinkPlatform::CpuRelax();
+		ready = has_room();
+	}
+	if (ready)
+	{
+		spun = true;
+		g_spin_limit = std::min(g_spin_limit * 2, MAX_SPINS);
+	}
+	else
+	{
+		g_spin_limit = std::max(g_spin_limit / 2, MIN_SPINS);
+	}
+
+	UINT32 nap_us = 50;
+	while (!ready)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			break;
+		const UINT32 left_us = (UINT32)std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count() + 1;
+		if (g_ring)
+		{
+			g_ring->helper_waiting.fetch_add(1);
+			const UINT32 seen = g_ring->drained.load();
+			if (!has_room())
+				GameLinkPlatform::WaitSignal(GameLinkPlatform::SIGNAL_DRAINED, &g_ring->drained, seen, left_us);
+			g_ring->helper_waiting.fetch_sub(1);
+		}
+		else
+		{
+			GameLinkPlatform::SleepUs(std::min(nap_us, left_us));
+			nap_us = std::min(nap_us * 2, MAX_POLL_US);
+		}
+		ready = has_room();
+	}
+
+	const double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::lock_guard<std::mutex> guard(g_write_stats_lock);
+	g_write_stats.writes++;
+	g_write_stats.waits++;
+	if (spun)
+		g_write_stats.spin_waits++;
+	if (!ready)
+		g_write_stats.timeouts++;
+	g_write_stats.total_wait_seconds += waited;
+	g_write_stats.max_wait_seconds = std::max(g_write_stats.max_wait_seconds, waited);
+	return ready ? WriteResult::OK : WriteResult::TIMEOUT;
+}
+
+// Hands a message of length bytes to the host: fill() writes it in place.
+// With a ring, it takes the next free slot and publishes it without the mutex,
+// otherwise it waits for buf_tohost to drain and fills it under the mutex.
+template <typename Fill>
+static WriteResult WriteToHost(size_t length, Fill fill)
+{
+	if (g_p_shared_memory == NULL)
+		return WriteResult::NOT_ACTIVE;
+	std::lock_guard<std::mutex> tohost_lock(g_tohost_lock);
+	if (g_ring)
+	{
+		const UINT64 head = g_ring->head.load(std::memory_order_relaxed);
+		WriteResult result = WaitForRoom([head]() {
+			return head - g_ring->tail.load(std::memory_order_acquire) < g_ring->slot_count;
+		});
+		if (result != WriteResult::OK)
+			return result;
+		sSharedMMapRing_R5::Slot& slot = g_ring->slots[head & (g_ring->slot_count - 1)];
+		fill(slot.data);
+		slot.length = (UINT32)length;
+		g_ring->head.store(head + 1, std::memory_order_release);
+		g_ring->published.fetch_add(1);
+		if (g_ring->server_waiting.load() != 0)
+			GameLinkPlatform::WakeSignal(GameLinkPlatform::SIGNAL_PUBLISHED, &g_ring->published);
+		return WriteResult::OK;
+	}
+
+	WriteResult result = WaitForRoom([]() {
+		return g_p_shared_memory->buf_tohost.payload == 0;
+	});
+	if (result != WriteResult::OK)
+		return result;
+	result = WriteResult::LOCK_FAILED;
+	switch (GameLinkPlatform::Lock(3000))
+	{
+	case LockResult::ACQUIRED:
+		fill(g_p_shared_memory->buf_tohost.data);
+		g_p_shared_memory->buf_tohost.payload = (UINT16)length;
+		GameLinkPlatform::Unlock();
+		result = WriteResult::OK;
+		break;
+	case LockResult::ABANDONED:
+		GameLinkPlatform::Unlock();
+		[[fallthrough]];
+	case LockResult::TIMEOUT:
+		[[fallthrough]];
+	case LockResult::FAILED:
+		[[fallthrough]];
+	default:
+		break;
+	}
+	return result;
+}
+
+const char* GameLink::WriteResultName(WriteResult result)
+{
+	switch (result)
+	{
+	case WriteResult::OK: return "ok";
+	case WriteResult::NOT_ACTIVE: return "GameLink isn't active";
+	case WriteResult::TOO_LARGE: return "message too large";
+	case WriteResult::TIMEOUT: return "timed out waiting for the emulator";
+	case WriteResult::LOCK_FAILED: return "couldn't get the mutex";
+	}
+	return "?";
+}
+
+void GameLink::SetWriteTimeout(UINT32 timeout_ms)
+{
+	g_write_timeout_ms.store(timeout_ms, std::memory_order_relaxed);
+}
+
+sWriteStats GameLink::GetWriteStats()
+{
+	std::lock_guard<std::mutex> guard(g_write_stats_lock);
+	return g_write_stats;
+}
+
+void GameLink::ResetWriteStats()
+{
+	std::lock_guard<std::mutex> guard(g_write_stats_lock);
+	g_write_stats = sWriteStats();
+}
 
 //------------------------------------------------------------------------------
-// Mutex methods
+// Frames from the host
 //------------------------------------------------------------------------------
 
-bool GetMutex()
+// Copies of a frame that tore this many times in a row give up, and keep the previous frame
+constexpr int MAX_FRAME_TRIES = 4;
+
+// GetFrameBufferInfo() copies frames into scratch, and swaps it with copy once a copy comes out whole.
+// Only the UI thread reads frames, so none of this needs a lock.
+static std::vector<UINT8> g_frame_copy;
+static std::vector<UINT8> g_frame_scratch;
+static sFramebufferInfo g_frame_info;
+static bool g_has_frame_copy;
+static UINT32 g_frame_copy_buffer;		// which of the v6 buffers the copy came from
+static UINT32 g_frame_copy_seq;			// and its seq, or the v4 frame's seq
+static sFrameStats g_frame_stats;
+
+// The frame buffers the server advertises, once checked against what's actually mapped
+static sSharedMMapFrames_R6* FindFrames()
+{
+	if (g_p_shared_memory->version < PROTOCOL_VER_FRAMES || g_ring == NULL)
+		return NULL;
+	const size_t offset = sSharedMMapFrames_R6::OffsetFor(g_p_shared_memory->ram_size, g_ring->slot_count);
+	if (GameLinkPlatform::GetSharedMemorySize() < offset + sizeof(sSharedMMapFrames_R6))
+		return NULL;
+	auto frames = reinterpret_cast<sSharedMMapFrames_R6*>(reinterpret_cast<UINT8*>(g_p_shared_memory) + offset);
+	if (frames->magic != sSharedMMapFrames_R6::MAGIC || frames->buffer_count != sSharedMMapFrames_R6::BUFFER_COUNT
+		|| frames->buffer_size != sizeof(sSharedMMapFrames_R6::Buffer))
+	{
+		OutputDebugStringW(L"WARNING: The shared memory's frame buffers aren't valid, using the single frame!\n");
+		return NULL;
+	}
+	return frames;
+}
+
+// Copies the frame header and as many pixels as it says it has into info and g_frame_scratch
+template <typename Frame>
+static void CopyFrame(const Frame& frame, sFramebufferInfo& info)
+{
+	info.width = frame.width;
+	info.height = frame.height;
+	info.imageFormat = frame.image_fmt;
+	info.parX = frame.par_x;
+	info.parY = frame.par_y;
+	if (info.imageFormat == 0)
+		info.bufferLength = 0;
+	else
+		info.bufferLength = std::min<UINT32>((UINT32)info.width * info.height * sizeof(UINT32), sSharedMMapFrame_R1::MAX_PAYLOAD);
+	g_frame_scratch.resize(info.bufferLength);
+	memcpy(g_frame_scratch.data(), frame.buffer, info.bufferLength);
+}
+
+static void KeepFrame(const sFramebufferInfo& info, UINT32 buffer, UINT32 seq)
 {
-	g_mutex_handle = OpenMutexA(SYNCHRONIZE, FALSE, GAMELINK_MUTEX_NAME);
-	if (g_mutex_handle == 0)
-		return false;
-	return true;
+	g_frame_copy.swap(g_frame_scratch);
+	g_frame_info = info;
+	g_frame_info.frameBuffer = g_frame_copy.data();
+	g_frame_copy_buffer = buffer;
+	g_frame_copy_seq = seq;
+	g_has_frame_copy = true;
+	g_frame_stats.copies++;
 }
 
-void CloseMutex()
+// Seqlock read of the newest v6 buffer
+static bool ReadFrameBuffers()
 {
-	if (g_mutex_handle != 0)
+	for (int tries = 0; tries < MAX_FRAME_TRIES; tries++)
 	{
-		CloseHandle(g_mutex_handle);
-		g_mutex_handle = NULL;
+		const UINT32 index = g_frames->latest.load(std::memory_order_acquire) % sSharedMMapFrames_R6::BUFFER_COUNT;
+		const sSharedMMapFrames_R6::Buffer& buffer = g_frames->buffers[index];
+		const UINT32 seq = buffer.seq.load(std::memory_order_acquire);
+		if (g_has_frame_copy && index == g_frame_copy_buffer && seq == g_frame_copy_seq)
+			return true;
+		sFramebufferInfo info = sFramebufferInfo();
+		if ((seq & 1) == 0)
+		{
+			CopyFrame(buffer, info);
+			info.seq = buffer.frame_seq;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (buffer.seq.load(std::memory_order_relaxed) == seq)
+			{
+				KeepFrame(info, index, seq);
+				return true;
+			}
+		}
+		// the server has come round to this buffer again, and wrote over it while it was copied
+		g_frame_stats.torn++;
 	}
+	return false;
+}
+
+// The v4 frame has no seqlock of its own, but the emulator moves seq once it's done writing a frame.
+// A copy during which seq moves is torn; one that starts after the emulator started writing can't be told apart.
+static bool ReadFrame()
+{
+	const sSharedMMapFrame_R1& frame = g_p_shared_memory->frame;
+	const volatile UINT16& frame_seq = frame.seq;
+	for (int tries = 0; tries < MAX_FRAME_TRIES; tries++)
+	{
+		const UINT16 seq = frame_seq;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (g_has_frame_copy && seq == g_frame_copy_seq
+			&& frame.width == g_frame_info.width && frame.height == g_frame_info.height && frame.image_fmt == g_frame_info.imageFormat)
+			return true;
+		sFramebufferInfo info = sFramebufferInfo();
+		CopyFrame(frame, info);
+		info.seq = seq;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (frame_seq == seq)
+		{
+			KeepFrame(info, 0, seq);
+			return true;
+		}
+		g_frame_stats.torn++;
+	}
+	return false;
+}
+
+sFramebufferInfo GameLink::GetFrameBufferInfo()
+{
+	if (g_p_shared_memory == NULL)
+		return sFramebufferInfo();
+	g_frame_stats.reads++;
+	const bool read = g_frames ? ReadFrameBuffers() : ReadFrame();
+	if (!read)
+		g_frame_stats.gave_up++;
+	if (!g_has_frame_copy)
+		return sFramebufferInfo();
+	g_frame_info.wantsMouse = (g_p_shared_memory->flags & FLAG_WANT_MOUSE);
+	return g_frame_info;
+}
+
+bool GameLink::HasFrameBuffers()
+{
+	return (g_frames != NULL);
+}
+
+sFrameStats GameLink::GetFrameStats()
+{
+	return g_frame_stats;
 }
 
 //------------------------------------------------------------------------------
@@ -184,35 +373,33 @@ int GameLink::Init()
 	if (g_p_shared_memory)
 		return 1;
 
-	g_mmap_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, GAMELINK_MMAP_NAME);
-	if (g_mmap_handle)
+	g_p_shared_memory = reinterpret_cast<sSharedMemoryMap_R4*>(GameLinkPlatform::OpenSharedMemory(MEMORY_MAP_CORE_SIZE));
+	if (g_p_shared_memory)
 	{
-//		UINT8 *shm = reinterpret_cast<UINT8*>(
-//			MapViewOfFile(g_mmap_handle, FILE_MAP_ALL_ACCESS, 0, 0, 0)
-//			);
-		g_p_shared_memory = reinterpret_cast<sSharedMemoryMap_R4*>(
-			MapViewOfFile(g_mmap_handle, FILE_MAP_ALL_ACCESS, 0, 0, 0)
-			);
-
-		if (g_p_shared_memory)
-		{
-			// Make sure to always request the PC of the processor
-			g_p_shared_memory->peek.addr_count = 2;
-			g_p_shared_memory->peek.addr[0] = (UINT)sSharedMMapPeek_R2::PEEK_SPECIAL_PC_H;
-			g_p_shared_memory->peek.addr[1] = (UINT)sSharedMMapPeek_R2::PEEK_SPECIAL_PC_L;
-			// The ram is right after the end of the shared memory pointer here
-			ramPointer = reinterpret_cast<UINT8*>(g_p_shared_memory + 1);
-			if (GetMutex()) {
-				// All is good, tell the emulator to go native video, we'll take care of the flipping in hardware!
-				SendCommand(std::string(":videonative"));
-				return 1;
-			}
-			OutputDebugStringW(L"WARNING: Found shared memory but couldn't get mutex!\n");
+		// Make sure to always request the PC of the processor
+		g_p_shared_memory->peek.addr_count = 2;
+		g_p_shared_memory->peek.addr[0] = (UINT)sSharedMMapPeek_R2::PEEK_SPECIAL_PC_H;
+		g_p_shared_memory->peek.addr[1] = (UINT)sSharedMMapPeek_R2::PEEK_SPECIAL_PC_L;
+		// The ram is right after the end of the shared memory pointer here
+		ramPointer = reinterpret_cast<UINT8*>(g_p_shared_memory + 1);
+		g_ring = FindRing();
+		if (g_ring && !GameLinkPlatform::OpenSignals())
+			OutputDebugStringW(L"WARNING: The command ring's signals aren't there, polling it instead!\n");
+		g_frames = FindFrames();
+		g_has_frame_copy = false;
+		if (GameLinkPlatform::OpenMutex()) {
+			// All is good, tell the emulator to go native video, we'll take care of the flipping in hardware!
+			SendCommand(std::string(":videonative"));
+			g_sdhr_generation++;
+			return 1;
 		}
+		OutputDebugStringW(L"WARNING: Found shared memory but couldn't get mutex!\n");
 		// tidy up file mapping.
-		CloseHandle(g_mmap_handle);
-		g_mmap_handle = NULL;
+		GameLinkPlatform::CloseSignals();
+		GameLinkPlatform::CloseSharedMemory();
 		g_p_shared_memory = NULL;
+		g_ring = NULL;
+		g_frames = NULL;
 	}
 	// Failure
 	return 0;
@@ -220,8 +407,13 @@ int GameLink::Init()
 
 void GameLink::Destroy()
 {
-	CloseMutex();
+	GameLinkPlatform::CloseMutex();
+	GameLinkPlatform::CloseSignals();
 	g_p_shared_memory = NULL;
+	g_ring = NULL;
+	g_frames = NULL;
+	g_has_frame_copy = false;
+	GameLinkPlatform::CloseSharedMemory();
 }
 
 std::string GameLink::GetEmulatedProgramName()
@@ -258,43 +450,25 @@ bool GameLink::IsActive()
 	return (g_p_shared_memory != NULL);
 }
 
+UINT32 GameLink::GetCommandRingSlots()
+{
+	return g_ring ? g_ring->slot_count : 0;
+}
+
 bool GameLink::IsTrackingOnly()
 {
 	int flags = g_p_shared_memory->flags;
 	return (flags & FLAG_NO_FRAME);
 }
 
-void GameLink::SendCommand(std::string command)
+WriteResult GameLink::SendCommand(std::string command)
 {
-	int wait_counter = 0;
-	while (g_p_shared_memory->buf_tohost.payload != 0) {
-		Sleep(10);
-		++wait_counter;
-		if (wait_counter == 300) {
-			return;
-		}
-	}
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
-	switch (dwWaitResult)
-	{
-	case WAIT_OBJECT_0:
-	{
-		UINT16 sz = (UINT16)command.size() + 1;
-		g_p_shared_memory->buf_tohost.payload = sz;
-		snprintf((char*)g_p_shared_memory->buf_tohost.data, sz, "%s", command.c_str());
-		ReleaseMutex(g_mutex_handle);
-		break;
-	}
-	case WAIT_ABANDONED:
-		ReleaseMutex(g_mutex_handle);
-		[[fallthrough]];
-	case WAIT_TIMEOUT:
-		[[fallthrough]];
-	case WAIT_FAILED:
-		[[fallthrough]];
-	default:
-		break;
-	}
+	if (command.size() >= sSharedMMapBuffer_R1::BUFFER_SIZE)
+		return WriteResult::TOO_LARGE;
+	UINT16 sz = (UINT16)command.size() + 1;
+	return WriteToHost(sz, [&](UINT8* data) {
+		snprintf((char*)data, sz, "%s", command.c_str());
+	});
 }
 
 void GameLink::Pause()
@@ -305,6 +479,7 @@ void GameLink::Pause()
 void GameLink::Reset()
 {
 	SendCommand(std::string(":reset"));
+	g_sdhr_generation++;
 }
 
 void GameLink::Shutdown()
@@ -325,95 +500,49 @@ void GameLink::SDHR_off()
 void GameLink::SDHR_reset()
 {
 	SendCommand(std::string(":sdhr_reset"));
+	g_sdhr_generation++;
 }
 
-//void GameLink::SDHR_write(uint8_t* buf, UINT16 buflength)
-//{
-//	const std::string gamelinkCmd = ":sdhr_write";
-//	UINT16 sz = buflength + gamelinkCmd.length() + 1 + 3;	// 3 is for the final SDHR_CMD_READY command
-//	if (sz < buflength)	// overflow
-//	{
-//		OutputDebugStringW(L"ERROR: Write buffer is too large, can't prepend the Gamelink command tag!\n");
-//		return;
-//	}
-//
-//	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
-//	switch (dwWaitResult)
-//	{
-//	case WAIT_OBJECT_0:
-//	{
-//		auto ptrdata = (char*)g_p_shared_memory->buf_tohost.data;
-//		memcpy(ptrdata, gamelinkCmd.c_str(), gamelinkCmd.length());
-//		ptrdata += gamelinkCmd.length();
-//		memcpy(ptrdata, buf, buflength);
-//		ptrdata += buflength;
-//		// final SDHR_CMD_READY command -- size 0x0000, followed by the ID
-//		ptrdata[0] = 0;
-//		ptrdata[1] = 0;
-//		ptrdata[2] = (uint8_t)SDHR_CMD::READY;
-//		g_p_shared_memory->buf_tohost.payload = sz;
-//		bReadyToProcess = true;
-//		ReleaseMutex(g_mutex_handle);
-//		break;
-//	}
-//	case WAIT_ABANDONED:
-//		ReleaseMutex(g_mutex_handle);
-//		[[fallthrough]];
-//	case WAIT_TIMEOUT:
-//		[[fallthrough]];
-//	case WAIT_FAILED:
-//		[[fallthrough]];
-//	default:
-//		break;
-//	}
-//}
-
-void GameLink::SDHR_write(const std::vector<uint8_t>& v_data)
-{
-	int wait_counter = 0;
-	while (g_p_shared_memory->buf_tohost.payload != 0) {
-		Sleep(10);
-		++wait_counter;
-		if (wait_counter == 300) {
-			return;
-		}
-	}
-	const std::string gamelinkCmd = ":sdhr_write";
-	UINT16 sz = v_data.size() + gamelinkCmd.length() + 1 + 3;	// 3 is for the final SDHR_CMD_READY command
-	if (sz < v_data.size())	// overflow
+UINT32 GameLink::SDHR_GetStateGeneration()
+{
+	return g_sdhr_generation.load(std::memory_order_relaxed);
+}
+
+// The SDHR write tag prepended to every batch in buf_tohost
+static const std::string g_sdhr_write_tag = ":sdhr_write";
+
+size_t GameLink::SDHR_GetMaxWriteLength()
+{
+	constexpr size_t max_payload = (UINT16_MAX < sSharedMMapBuffer_R1::BUFFER_SIZE) ? UINT16_MAX : sSharedMMapBuffer_R1::BUFFER_SIZE;
+	return max_payload - g_sdhr_write_tag.length() - 1 - 3;	// 3 is for the final SDHR_CMD_READY command
+}
+
+WriteResult GameLink::SDHR_write(const uint8_t* buf, size_t buflength)
+{
+	const std::string& gamelinkCmd = g_sdhr_write_tag;
+	size_t sz = buflength + gamelinkCmd.length() + 1 + 3;	// 3 is for the final SDHR_CMD_READY command
+	if (buflength > SDHR_GetMaxWriteLength())	// overflow
 	{
-		OutputDebugStringW(L"ERROR: Write vector buffer is too large, can't prepend the Gamelink command tag!\n");
-		return;
+		OutputDebugStringW(L"ERROR: Write buffer is too large, can't prepend the Gamelink command tag!\n");
+		return WriteResult::TOO_LARGE;
 	}
 
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
-	switch (dwWaitResult)
-	{
-	case WAIT_OBJECT_0:
-	{
-		auto ptrdata = (char*)g_p_shared_memory->buf_tohost.data;
+	return WriteToHost(sz, [&](UINT8* data) {
+		auto ptrdata = (char*)data;
 		memcpy(ptrdata, gamelinkCmd.c_str(), gamelinkCmd.length());
 		ptrdata += gamelinkCmd.length();
-		std::copy(v_data.begin(), v_data.end(), ptrdata);
-		ptrdata += v_data.size();
+		memcpy(ptrdata, buf, buflength);
+		ptrdata += buflength;
 		// final SDHR_CMD_READY command -- size 0x0000, followed by the ID
 		ptrdata[0] = 0;
 		ptrdata[1] = 0;
 		ptrdata[2] = (uint8_t)SDHR_CMD::READY;
-		g_p_shared_memory->buf_tohost.payload = sz;
-		ReleaseMutex(g_mutex_handle);
-		break;
-	}
-	case WAIT_ABANDONED:
-		ReleaseMutex(g_mutex_handle);
-		[[fallthrough]];
-	case WAIT_TIMEOUT:
-		[[fallthrough]];
-	case WAIT_FAILED:
-		[[fallthrough]];
-	default:
-		break;
-	}
+	});
+}
+
+WriteResult GameLink::SDHR_write(const std::vector<uint8_t>& v_data)
+{
+	return SDHR_write(v_data.data(), v_data.size());
 }
 
 void GameLink::SetSoundVolume(UINT8 main, UINT8 mockingboard)
@@ -426,20 +555,19 @@ void GameLink::SetSoundVolume(UINT8 main, UINT8 mockingboard)
 		mockingboard = 0;
 	if (mockingboard > 100)
 		mockingboard = 100;
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
-	switch (dwWaitResult)
+	switch (GameLinkPlatform::Lock(3000))
 	{
-	case WAIT_OBJECT_0:
+	case LockResult::ACQUIRED:
 		g_p_shared_memory->audio.master_vol_l = main;
 		g_p_shared_memory->audio.master_vol_r = mockingboard;
-		ReleaseMutex(g_mutex_handle);
+		GameLinkPlatform::Unlock();
 		break;
-	case WAIT_ABANDONED:
-		ReleaseMutex(g_mutex_handle);
+	case LockResult::ABANDONED:
+		GameLinkPlatform::Unlock();
 		[[fallthrough]];
-	case WAIT_TIMEOUT:
+	case LockResult::TIMEOUT:
 		[[fallthrough]];
-	case WAIT_FAILED:
+	case LockResult::FAILED:
 		[[fallthrough]];
 	default:
 		break;
@@ -449,20 +577,19 @@ void GameLink::SetSoundVolume(UINT8 main, UINT8 mockingboard)
 
 int GameLink::GetSoundVolumeMain()
 {
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
 	int ret = 0;
-	switch (dwWaitResult)
+	switch (GameLinkPlatform::Lock(3000))
 	{
-	case WAIT_OBJECT_0:
+	case LockResult::ACQUIRED:
 		ret = g_p_shared_memory->audio.master_vol_l;
-		ReleaseMutex(g_mutex_handle);
+		GameLinkPlatform::Unlock();
 		break;
-	case WAIT_ABANDONED:
-		ReleaseMutex(g_mutex_handle);
+	case LockResult::ABANDONED:
+		GameLinkPlatform::Unlock();
 		[[fallthrough]];
-	case WAIT_TIMEOUT:
+	case LockResult::TIMEOUT:
 		[[fallthrough]];
-	case WAIT_FAILED:
+	case LockResult::FAILED:
 		[[fallthrough]];
 	default:
 		break;
@@ -472,20 +599,19 @@ int GameLink::GetSoundVolumeMain()
 
 int GameLink::GetSoundVolumeMockingboard()
 {
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
 	int ret = 0;
-	switch (dwWaitResult)
+	switch (GameLinkPlatform::Lock(3000))
 	{
-	case WAIT_OBJECT_0:
+	case LockResult::ACQUIRED:
 		ret = g_p_shared_memory->audio.master_vol_r;
-		ReleaseMutex(g_mutex_handle);
+		GameLinkPlatform::Unlock();
 		break;
-	case WAIT_ABANDONED:
-		ReleaseMutex(g_mutex_handle);
+	case LockResult::ABANDONED:
+		GameLinkPlatform::Unlock();
 		[[fallthrough]];
-	case WAIT_TIMEOUT:
+	case LockResult::TIMEOUT:
 		[[fallthrough]];
-	case WAIT_FAILED:
+	case LockResult::FAILED:
 		[[fallthrough]];
 	default:
 		break;
@@ -493,72 +619,28 @@ int GameLink::GetSoundVolumeMockingboard()
 	return ret;
 }
 
-void GameLink::SendKeystroke(UINT scancode, bool isPressed)
+WriteResult GameLink::SendKeyboardState(const UINT keyb_state[8], UINT32 timeout_ms)
 {
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 3000);
-	switch (dwWaitResult)
-	{
-	case WAIT_OBJECT_0:
+	if (g_p_shared_memory == NULL)
+		return WriteResult::NOT_ACTIVE;
+	switch (GameLinkPlatform::Lock(timeout_ms))
 	{
-		UINT scanbyte = (scancode / 32);
-		UINT scanbit = (1 << (scancode % 32));
+	case LockResult::ACQUIRED:
+		// the input channel is packed, so its words get no atomic stores; the mutex makes them one update
+		memcpy(g_p_shared_memory->input_other.keyb_state, keyb_state, sizeof(g_p_shared_memory->input_other.keyb_state));
 		g_p_shared_memory->input_other.ready = sSharedMMapInput_R2::READY_OTHER;
-		if (isPressed)
-			g_p_shared_memory->input_other.keyb_state[scanbyte] |= scanbit;
-		else
-			g_p_shared_memory->input_other.keyb_state[scanbyte] &= (~scanbit);
-		ReleaseMutex(g_mutex_handle);
-		break;
-	}
-	case WAIT_ABANDONED:
-		ReleaseMutex(g_mutex_handle);
-		[[fallthrough]];
-	case WAIT_TIMEOUT:
-		[[fallthrough]];
-	case WAIT_FAILED:
+		GameLinkPlatform::Unlock();
+		return WriteResult::OK;
+	case LockResult::TIMEOUT:
+		return WriteResult::TIMEOUT;
+	case LockResult::ABANDONED:
+		GameLinkPlatform::Unlock();
 		[[fallthrough]];
-	default:
-		break;
-	}
-}
-
-sFramebufferInfo GameLink::GetFrameBufferInfo()
-{
-	sFramebufferInfo fbI = sFramebufferInfo();
-	DWORD dwWaitResult = WaitForSingleObject(g_mutex_handle, 1000);
-	switch (dwWaitResult)
-	{
-	case WAIT_ABANDONED:
-		OutputDebugStringW(L"Abandoned\n");
-		ReleaseMutex(g_mutex_handle);
-		break;
-	case WAIT_FAILED:
-		OutputDebugStringW(L"Failed\n");
-		break;
-	case WAIT_TIMEOUT:
-		OutputDebugStringW(L"Timeout in getting mutex for frame buffer info. Still grabbing the read-only data anyway\n");
+	case LockResult::FAILED:
 		[[fallthrough]];
 	default:
-		sSharedMMapFrame_R1* f = &g_p_shared_memory->frame;
-		fbI.frameBuffer = f->buffer;
-		fbI.width = f->width;
-		fbI.height = f->height;
-		fbI.imageFormat = f->image_fmt;
-		if (fbI.imageFormat == 0)
-		{
-			fbI.bufferLength = 0;
-		}
-		else
-		{
-			fbI.bufferLength = fbI.width * fbI.height * sizeof(UINT32);
-		}
-		fbI.parX = f->par_x;
-		fbI.parY = f->par_y;
-		fbI.wantsMouse = (g_p_shared_memory->flags & FLAG_WANT_MOUSE);
-		ReleaseMutex(g_mutex_handle);
-		break;
+		return WriteResult::LOCK_FAILED;
 	}
-	return fbI;
 }
 
 UINT16 GameLink::GetFrameSequence()
@@ -566,4 +648,3 @@ UINT16 GameLink::GetFrameSequence()
 	return g_p_shared_memory->frame.seq;
 }
 
-
@@ -1,5 +1,6 @@
 #pragma once
 
+#ifdef _WIN32
 #include <winsdkver.h>
 #define _WIN32_WINNT 0x0A00
 #include <sdkddkver.h>
@@ -11,6 +12,26 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <Windows.h>
+#else
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+
+// The Windows types the shared memory layout and the rest of the helper are written with
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef unsigned int UINT;
+typedef unsigned long DWORD;
+
+// Debug output goes to stderr
+inline void OutputDebugStringW(const wchar_t* message)
+{
+	fprintf(stderr, "%ls", message);
+}
+#endif
 
 #include <string>
 #include <vector>
@@ -36,6 +57,8 @@ enum class SDHR_CMD {
 	READY = 14,
 	UPLOAD_DATA_FILENAME = 15,
 	UPDATE_WINDOW_SET_UPLOAD = 16,
+	UPLOAD_DATA_COMPRESSED = 17,
+	UPDATE_WINDOW_SET_BOTH_COMPRESSED = 18,
 };
 
 //------------------------------------------------------------------------------
@@ -49,6 +72,38 @@ namespace GameLink
 	// Global Declarations
 	//--------------------------------------------------------------------------
 
+	// How a message to the emulator went
+	enum class WriteResult {
+		OK,
+		NOT_ACTIVE,		// no shared memory
+		TOO_LARGE,		// doesn't fit in a message
+		TIMEOUT,		// the emulator didn't make room for it in time
+		LOCK_FAILED,	// the mutex couldn't be had
+	};
+
+	// How long messages to the emulator waited for room, since the last ResetWriteStats()
+	struct sWriteStats
+	{
+		UINT64 writes = 0;
+		UINT64 waits = 0;				// writes that found no room at first
+		UINT64 spin_waits = 0;			// of those, the ones the spin was enough for
+		UINT64 timeouts = 0;
+		double total_wait_seconds = 0;
+		double max_wait_seconds = 0;
+
+		double MeanWaitSeconds() const { return waits ? (total_wait_seconds / waits) : 0; };
+	};
+
+	// How GetFrameBufferInfo() fared copying frames out from under the emulator, which never waits for it
+	struct sFrameStats
+	{
+		UINT64 reads = 0;			// GetFrameBufferInfo() calls
+		UINT64 copies = 0;			// new frames copied whole
+		UINT64 torn = 0;			// copies the emulator wrote over midway, made again
+		UINT64 gave_up = 0;			// reads still torn after every try, that kept the previous frame
+	};
+
+	// The frame as it was copied out of shared memory. frameBuffer stays valid until the next GetFrameBufferInfo().
 	struct sFramebufferInfo
 	{
 		UINT16 width;
@@ -58,6 +113,7 @@ namespace GameLink
 		UINT16 parY;
 		UINT32 bufferLength;
 		bool wantsMouse;
+		UINT16 seq;			// changes with every new frame
 		UINT8* frameBuffer;
 	};
 
@@ -74,24 +130,45 @@ namespace GameLink
 	extern UINT8 GetPeekAt(UINT position);
 	extern bool IsActive();
 	extern bool IsTrackingOnly();
+	// Slots in the emulator's command ring, or 0 if it only has the single buf_tohost (before protocol v5)
+	extern UINT32 GetCommandRingSlots();
+
+	extern const char* WriteResultName(WriteResult result);
+	// How long a message waits for the emulator to make room for it. 3 seconds until changed.
+	extern void SetWriteTimeout(UINT32 timeout_ms);
+	extern sWriteStats GetWriteStats();
+	extern void ResetWriteStats();
 
-	extern void SendCommand(std::string command);
+	extern WriteResult SendCommand(std::string command);
 	extern void Pause();
 	extern void Reset();
 	extern void Shutdown();
 	extern void SDHR_on();
 	extern void SDHR_off();
 	extern void SDHR_reset();
-	//extern void SDHR_write(uint8_t* buf, UINT16 buflength);
-	extern void SDHR_write(const std::vector<uint8_t>& v_data);
+	// Changes whenever the emulator's SDHR state may have been reset: on SDHR_reset(), Reset() and Init()
+	extern UINT32 SDHR_GetStateGeneration();
+	// Writes an encoded command batch to SHM, followed by SDHR_CMD_READY
+	// Fails with TOO_LARGE if the batch doesn't fit in the buffer, or TIMEOUT if the buffer never drained
+	extern WriteResult SDHR_write(const uint8_t* buf, size_t buflength);
+	extern WriteResult SDHR_write(const std::vector<uint8_t>& v_data);
+	// Largest encoded batch SDHR_write accepts in one go, once the command tag and SDHR_CMD_READY are added
+	extern size_t SDHR_GetMaxWriteLength();
 
 	extern void SetSoundVolume(UINT8 main, UINT8 mockingboard);
 	extern int GetSoundVolumeMain();
 	extern int GetSoundVolumeMockingboard();
 
-	extern void SendKeystroke(UINT scancode, bool isPressed);
+	// Replaces the whole 256-key scancode bitmap of the other input channel at once, waiting up to timeout_ms
+	// for the mutex. Fails with TIMEOUT rather than waiting longer, so the caller can try again later.
+	// GameLinkInput is the one writer of that channel, key events go through it.
+	extern WriteResult SendKeyboardState(const UINT keyb_state[8], UINT32 timeout_ms);
 
+	// Copies the newest frame out without taking the mutex, unless it's the one already copied. UI thread only.
 	extern sFramebufferInfo GetFrameBufferInfo();
-	extern inline UINT16 GetFrameSequence();
+	// True if the server has the lock-free frame buffers of protocol v6, rather than just the v4 frame
+	extern bool HasFrameBuffers();
+	extern sFrameStats GetFrameStats();
+	extern UINT16 GetFrameSequence();
 
 }; // namespace GameLink
@@ -0,0 +1,50 @@
+#include "GameLinkInput.h"
+#include <algorithm>
+
+void GameLinkInput::KeyEvent(UINT scancode, bool isPressed)
+{
+	if (scancode >= KEY_COUNT || Latest().IsPressed(scancode) == isPressed)
+		return;
+	stats.events++;
+	// a key that already changed in the last bitmap would lose that change, so it gets a bitmap of its own
+	if (v_pending.empty() || (changed.IsPressed(scancode) && v_pending.size() < MAX_PENDING))
+	{
+		v_pending.push_back(Latest());
+		changed = KeyboardState();
+	}
+	else if (changed.IsPressed(scancode))
+	{
+		stats.merged++;
+	}
+	v_pending.back().Set(scancode, isPressed);
+	changed.Set(scancode, true);
+	stats.max_pending = std::max(stats.max_pending, v_pending.size());
+}
+
+GameLink::WriteResult GameLinkInput::Publish()
+{
+	if (v_pending.empty())
+		return GameLink::WriteResult::OK;
+	if (!GameLink::IsActive())
+		return GameLink::WriteResult::NOT_ACTIVE;
+	const GameLink::WriteResult result = GameLink::SendKeyboardState(v_pending.front().words, LOCK_TIMEOUT_MS);
+	if (result != GameLink::WriteResult::OK)
+	{
+		stats.lock_misses++;
+		return result;
+	}
+	published = v_pending.front();
+	v_pending.pop_front();
+	// the new last bitmap's changes are all out, or it's still the one collecting them
+	if (v_pending.empty())
+		changed = KeyboardState();
+	stats.publishes++;
+	return result;
+}
+
+void GameLinkInput::Reset()
+{
+	published = KeyboardState();
+	v_pending.clear();
+	changed = KeyboardState();
+}
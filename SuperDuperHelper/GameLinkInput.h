@@ -0,0 +1,71 @@
+#pragma once
+#include "GameLink.h"
+#include <deque>
+
+/**
+ * @brief GameLinkInputStats
+ * What a GameLinkInput did since it was created
+*/
+struct GameLinkInputStats
+{
+	size_t events = 0;			// key transitions taken in
+	size_t publishes = 0;		// keyboard states written to SHM
+	size_t lock_misses = 0;		// publishes put off to the next frame because the mutex was busy
+	size_t merged = 0;			// states folded into the next one because MAX_PENDING were already waiting
+	size_t max_pending = 0;		// most states waiting at once
+};
+
+/**
+ * @brief GameLinkInput
+ * Collects the key transitions of a UI frame into a 256-bit scancode bitmap, and writes it to the
+ * emulator's other input channel once per frame, in a single short critical section, instead of
+ * taking the GameLink mutex for every key event.
+ * A key that changes twice before the bitmap goes out, like a tap that's pressed and released within
+ * one frame, starts a new bitmap. Bitmaps wait in order and go out one per Publish(), so the emulator
+ * sees the press on one frame and the release on the next.
+ * If the mutex is busy, Publish() keeps the bitmap for the next frame rather than wait.
+ * UI thread only.
+*/
+class GameLinkInput
+{
+public:
+	enum { KEY_COUNT = 256 };
+	enum { WORD_COUNT = KEY_COUNT / 32 };
+	// Bitmaps that may wait; past that, new transitions fold into the last one and quick taps may be lost
+	enum { MAX_PENDING = 64 };
+	// Longest Publish() waits for the mutex
+	enum { LOCK_TIMEOUT_MS = 1 };
+
+	struct KeyboardState
+	{
+		UINT words[WORD_COUNT] = {};
+
+		bool IsPressed(UINT scancode) const { return (words[scancode / 32] >> (scancode % 32)) & 1; };
+		void Set(UINT scancode, bool isPressed)
+		{
+			if (isPressed)
+				words[scancode / 32] |= (1u << (scancode % 32));
+			else
+				words[scancode / 32] &= ~(1u << (scancode % 32));
+		};
+	};
+
+	// Takes in a key transition. Scancodes past KEY_COUNT, and repeats of the state a key is already in, are ignored.
+	void KeyEvent(UINT scancode, bool isPressed);
+	// Writes the oldest waiting bitmap to SHM, if there is one. Call once per UI frame.
+	GameLink::WriteResult Publish();
+	// Forgets what's waiting and what the emulator was sent, after GameLink lost or got the emulator
+	void Reset();
+
+	size_t GetPendingCount() const { return v_pending.size(); };
+	const GameLinkInputStats& GetStats() const { return stats; };
+
+private:
+	// The state keys are in once everything waiting is out
+	const KeyboardState& Latest() const { return v_pending.empty() ? published : v_pending.back(); };
+
+	KeyboardState published;				// what the emulator was last sent
+	std::deque<KeyboardState> v_pending;	// oldest first
+	KeyboardState changed;					// keys changed in v_pending.back()
+	GameLinkInputStats stats;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "GameLink.h"
+#include <atomic>
+
+/**
+ * @brief GameLinkPlatform
+ * The OS side of GameLink: mapping the emulator's shared memory, taking its mutex,
+ * and sleeping until the other side signals the command ring.
+ * GameLinkPlatformWin32.cpp uses the named file mapping and mutex AppleWin creates,
+ * GameLinkPlatformPosix.cpp uses shm_open() objects of the same names and a process-shared pthread mutex.
+ * Only one of them is built.
+*/
+
+namespace GameLinkPlatform
+{
+	enum class LockResult {
+		ACQUIRED,
+		ABANDONED,	// acquired, but its last owner died holding it
+		TIMEOUT,
+		FAILED,
+	};
+
+	// Maps the shared memory, of at least min_size bytes. Returns nullptr if there's none.
+	extern void* OpenSharedMemory(size_t min_size);
+	extern void CloseSharedMemory();
+	// Bytes mapped, which may be more than the min_size asked for
+	extern size_t GetSharedMemorySize();
+
+	extern bool OpenMutex();
+	extern void CloseMutex();
+	extern LockResult Lock(UINT32 timeout_ms);
+	extern void Unlock();
+
+	enum Signal {
+		SIGNAL_PUBLISHED,	// the helper put messages in the ring
+		SIGNAL_DRAINED,		// the server took messages out of the ring
+		SIGNAL_COUNT,
+	};
+
+	// Opens the named events of the signals on Windows; futexes need nothing
+	extern bool OpenSignals();
+	extern void CloseSignals();
+	// Blocks until the signal is woken, *counter no longer holds seen, or timeout_us passes.
+	// It may return early, so callers check what they're waiting for again.
+	extern void WaitSignal(Signal signal, std::atomic<UINT32>* counter, UINT32 seen, UINT32 timeout_us);
+	// Wakes whoever waits on the signal, after counter has been bumped
+	extern void WakeSignal(Signal signal, std::atomic<UINT32>* counter);
+
+	extern void SleepMs(UINT32 ms);
+	extern void SleepUs(UINT32 us);
+
+	// Busy-wait hint for spin loops
+	inline void CpuRelax()
+	{
+#if defined(_WIN32)
+		YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+}; // namespace GameLinkPlatform
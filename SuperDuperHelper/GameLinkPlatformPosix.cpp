@@ -0,0 +1,157 @@
+#include "GameLinkPlatform.h"
+#include "GameLinkShared.h"
+
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace GameLinkPlatform;
+
+static void* g_mmap_view;
+static size_t g_mmap_size;
+static sSharedMutex_Posix* g_mutex;
+
+// Maps a whole shared memory object, if it's there and at least min_size bytes
+static void* MapObject(const char* name, size_t min_size, size_t& size)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return nullptr;
+	void* view = nullptr;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= min_size)
+	{
+		size = (size_t)st.st_size;
+		view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (view == MAP_FAILED)
+			view = nullptr;
+	}
+	else
+	{
+		OutputDebugStringW(L"WARNING: Found shared memory but it's too small!\n");
+	}
+	// the mapping keeps the object alive
+	close(fd);
+	return view;
+}
+
+void* GameLinkPlatform::OpenSharedMemory(size_t min_size)
+{
+	if (g_mmap_view == nullptr)
+		g_mmap_view = MapObject(GAMELINK_POSIX_MMAP_NAME, min_size, g_mmap_size);
+	return g_mmap_view;
+}
+
+void GameLinkPlatform::CloseSharedMemory()
+{
+	if (g_mmap_view)
+	{
+		munmap(g_mmap_view, g_mmap_size);
+		g_mmap_view = nullptr;
+		g_mmap_size = 0;
+	}
+}
+
+size_t GameLinkPlatform::GetSharedMemorySize()
+{
+	return g_mmap_size;
+}
+
+bool GameLinkPlatform::OpenMutex()
+{
+	size_t size;
+	g_mutex = (sSharedMutex_Posix*)MapObject(GAMELINK_POSIX_MUTEX_NAME, sizeof(sSharedMutex_Posix), size);
+	return (g_mutex != nullptr);
+}
+
+void GameLinkPlatform::CloseMutex()
+{
+	if (g_mutex)
+	{
+		munmap(g_mutex, sizeof(sSharedMutex_Posix));
+		g_mutex = nullptr;
+	}
+}
+
+LockResult GameLinkPlatform::Lock(UINT32 timeout_ms)
+{
+	if (g_mutex == nullptr)
+		return LockResult::FAILED;
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	switch (pthread_mutex_timedlock(&g_mutex->mutex, &deadline))
+	{
+	case 0:
+		return LockResult::ACQUIRED;
+	case EOWNERDEAD:
+		// like WAIT_ABANDONED, we own it now; it stays usable for whoever comes next
+		pthread_mutex_consistent(&g_mutex->mutex);
+		return LockResult::ABANDONED;
+	case ETIMEDOUT:
+		return LockResult::TIMEOUT;
+	default:
+		return LockResult::FAILED;
+	}
+}
+
+void GameLinkPlatform::Unlock()
+{
+	if (g_mutex)
+		pthread_mutex_unlock(&g_mutex->mutex);
+}
+
+bool GameLinkPlatform::OpenSignals()
+{
+	return true;
+}
+
+void GameLinkPlatform::CloseSignals()
+{
+}
+
+void GameLinkPlatform::WaitSignal(Signal signal, std::atomic<UINT32>* counter, UINT32 seen, UINT32 timeout_us)
+{
+#ifdef __linux__
+	// the counters live in shared memory, so these are shared futexes
+	struct timespec timeout;
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_nsec = (long)(timeout_us % 1000000) * 1000;
+	syscall(SYS_futex, reinterpret_cast<UINT32*>(counter), FUTEX_WAIT, seen, &timeout, nullptr, 0);
+#else
+	// no futexes: a short nap stands in for them
+	if (counter->load(std::memory_order_acquire) == seen)
+		SleepUs(timeout_us < 100 ? timeout_us : 100);
+#endif
+}
+
+void GameLinkPlatform::WakeSignal(Signal signal, std::atomic<UINT32>* counter)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<UINT32*>(counter), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+void GameLinkPlatform::SleepMs(UINT32 ms)
+{
+	usleep((useconds_t)ms * 1000);
+}
+
+void GameLinkPlatform::SleepUs(UINT32 us)
+{
+	usleep((useconds_t)us);
+}
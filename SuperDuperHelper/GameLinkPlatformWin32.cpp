@@ -0,0 +1,146 @@
+#include "GameLinkPlatform.h"
+#include "GameLinkShared.h"
+
+#include <algorithm>
+
+using namespace GameLinkPlatform;
+
+static HANDLE g_mutex_handle;
+static HANDLE g_mmap_handle;
+static void* g_mmap_view;
+static size_t g_mmap_size;
+static HANDLE g_signal_events[SIGNAL_COUNT];
+
+void* GameLinkPlatform::OpenSharedMemory(size_t min_size)
+{
+	if (g_mmap_view)
+		return g_mmap_view;
+	g_mmap_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, GAMELINK_MMAP_NAME);
+	if (g_mmap_handle == 0)
+		return nullptr;
+	g_mmap_view = MapViewOfFile(g_mmap_handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (g_mmap_view)
+	{
+		MEMORY_BASIC_INFORMATION info;
+		if (VirtualQuery(g_mmap_view, &info, sizeof(info)) != 0 && info.RegionSize >= min_size)
+		{
+			g_mmap_size = info.RegionSize;
+			return g_mmap_view;
+		}
+		OutputDebugStringW(L"WARNING: Found shared memory but it's too small!\n");
+	}
+	CloseSharedMemory();
+	return nullptr;
+}
+
+void GameLinkPlatform::CloseSharedMemory()
+{
+	if (g_mmap_view)
+	{
+		UnmapViewOfFile(g_mmap_view);
+		g_mmap_view = NULL;
+		g_mmap_size = 0;
+	}
+	if (g_mmap_handle != 0)
+	{
+		CloseHandle(g_mmap_handle);
+		g_mmap_handle = NULL;
+	}
+}
+
+size_t GameLinkPlatform::GetSharedMemorySize()
+{
+	return g_mmap_size;
+}
+
+bool GameLinkPlatform::OpenMutex()
+{
+	g_mutex_handle = OpenMutexA(SYNCHRONIZE, FALSE, GAMELINK_MUTEX_NAME);
+	if (g_mutex_handle == 0)
+		return false;
+	return true;
+}
+
+void GameLinkPlatform::CloseMutex()
+{
+	if (g_mutex_handle != 0)
+	{
+		CloseHandle(g_mutex_handle);
+		g_mutex_handle = NULL;
+	}
+}
+
+LockResult GameLinkPlatform::Lock(UINT32 timeout_ms)
+{
+	switch (WaitForSingleObject(g_mutex_handle, timeout_ms))
+	{
+	case WAIT_OBJECT_0:
+		return LockResult::ACQUIRED;
+	case WAIT_ABANDONED:
+		return LockResult::ABANDONED;
+	case WAIT_TIMEOUT:
+		return LockResult::TIMEOUT;
+	case WAIT_FAILED:
+		[[fallthrough]];
+	default:
+		return LockResult::FAILED;
+	}
+}
+
+void GameLinkPlatform::Unlock()
+{
+	ReleaseMutex(g_mutex_handle);
+}
+
+bool GameLinkPlatform::OpenSignals()
+{
+	static const char* names[SIGNAL_COUNT] = { GAMELINK_PUBLISHED_EVENT_NAME, GAMELINK_DRAINED_EVENT_NAME };
+	bool opened = true;
+	for (int i = 0; i < SIGNAL_COUNT; i++)
+	{
+		if (g_signal_events[i] == 0)
+			g_signal_events[i] = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, names[i]);
+		opened = opened && (g_signal_events[i] != 0);
+	}
+	return opened;
+}
+
+void GameLinkPlatform::CloseSignals()
+{
+	for (int i = 0; i < SIGNAL_COUNT; i++)
+	{
+		if (g_signal_events[i] != 0)
+		{
+			CloseHandle(g_signal_events[i]);
+			g_signal_events[i] = NULL;
+		}
+	}
+}
+
+void GameLinkPlatform::WaitSignal(Signal signal, std::atomic<UINT32>* counter, UINT32 seen, UINT32 timeout_us)
+{
+	if (counter->load(std::memory_order_acquire) != seen)
+		return;
+	// without the event, a short nap stands in for it
+	if (g_signal_events[signal] == 0)
+		SleepUs(std::min<UINT32>(timeout_us, 1000));
+	else
+		WaitForSingleObject(g_signal_events[signal], (timeout_us + 999) / 1000);
+}
+
+void GameLinkPlatform::WakeSignal(Signal signal, std::atomic<UINT32>* counter)
+{
+	if (g_signal_events[signal] != 0)
+		SetEvent(g_signal_events[signal]);
+}
+
+void GameLinkPlatform::SleepMs(UINT32 ms)
+{
+	Sleep(ms);
+}
+
+void GameLinkPlatform::SleepUs(UINT32 us)
+{
+	// Sleep() can't do better than milliseconds, 0 just gives up the time slice
+	Sleep((us + 999) / 1000);
+}
@@ -0,0 +1,345 @@
+/**
+ * @brief GameLinkServer
+ * Stand-in for AppleWin's side of GameLink on Linux, to run and load-test the helper without the emulator.
+ * It creates the shared memory and its mutex the way GameLinkPlatformPosix.cpp opens them,
+ * drains buf_tohost, parses :sdhr_write batches and :sdhr_process, counts key changes, and writes synthetic frames.
+ * Unless --ring 0, it also offers a command ring of that many slots (protocol v5) and drains it first,
+ * and unless --frames 0 as well, writes its frames to the lock-free frame buffers too (protocol v6).
+ * It sleeps until the helper signals the ring, and polls buf_tohost every --poll-us.
+ * Once a second it prints what it received.
+ *
+ * Usage: gamelink_server [--fps N] [--frames 0|1] [--poll-us N] [--ram BYTES] [--ring SLOTS] [--seconds N]
+*/
+
+#include "GameLinkShared.h"
+#include "GameLinkPlatform.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct sServerStats
+{
+	size_t messages = 0;		// anything drained from buf_tohost or the ring
+	size_t ring_messages = 0;	// of those, from the ring
+	size_t writes = 0;			// :sdhr_write
+	size_t processes = 0;		// :sdhr_process
+	size_t other = 0;			// every other command
+	size_t malformed = 0;		// :sdhr_write batches that don't walk to SDHR_CMD::READY
+	size_t commands = 0;		// SDHR commands in the batches
+	size_t bytes = 0;			// of the batches
+	size_t frames = 0;
+	size_t key_changes = 0;		// keys seen going down or up in input_other
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void OnSignal(int)
+{
+	g_stop = 1;
+}
+
+static void* CreateObject(const char* name, size_t size)
+{
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+	{
+		perror(name);
+		return nullptr;
+	}
+	void* view = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0)
+		view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	else
+		perror(name);
+	close(fd);
+	return (view == MAP_FAILED) ? nullptr : view;
+}
+
+static bool InitMutex(sSharedMutex_Posix* shared)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	const bool ok = (pthread_mutex_init(&shared->mutex, &attr) == 0);
+	pthread_mutexattr_destroy(&attr);
+	return ok;
+}
+
+static void Lock(sSharedMutex_Posix* shared)
+{
+	if (pthread_mutex_lock(&shared->mutex) == EOWNERDEAD)
+		pthread_mutex_consistent(&shared->mutex);
+}
+
+// Walks an :sdhr_write batch, without the tag, up to its final SDHR_CMD::READY
+static bool ParseBatch(const UINT8* data, size_t length, sServerStats& stats)
+{
+	size_t offset = 0;
+	while (offset + 3 <= length)
+	{
+		UINT16 size;
+		memcpy(&size, data + offset, 2);
+		const UINT8 id = data[offset + 2];
+		if (size == 0 && id == (UINT8)SDHR_CMD::READY)
+			return true;
+		if (offset + 3 + size > length)
+			return false;
+		stats.commands++;
+		stats.bytes += 3 + (size_t)size;
+		offset += 3 + (size_t)size;
+	}
+	return false;
+}
+
+static void HandleMessage(const std::string& message, sServerStats& stats)
+{
+	static const std::string write_tag = ":sdhr_write";
+	stats.messages++;
+	if (message.compare(0, write_tag.length(), write_tag) == 0)
+	{
+		stats.writes++;
+		if (!ParseBatch((const UINT8*)message.data() + write_tag.length(), message.length() - write_tag.length(), stats))
+			stats.malformed++;
+	}
+	else if (message.compare(0, message.find('\0'), ":sdhr_process") == 0)
+	{
+		stats.processes++;
+	}
+	else
+	{
+		stats.other++;
+		printf("command: %s\n", message.c_str());
+	}
+}
+
+static void Drain(sSharedMemoryMap_R4* shm, sSharedMutex_Posix* shared, sSharedMMapRing_R5* ring, std::string& message, sServerStats& stats)
+{
+	static UINT keyb_state[8];
+	if (ring)
+	{
+		UINT64 tail = ring->tail.load(std::memory_order_relaxed);
+		const UINT64 head = ring->head.load(std::memory_order_acquire);
+		for (; tail != head; tail++)
+		{
+			const sSharedMMapRing_R5::Slot& slot = ring->slots[tail & (ring->slot_count - 1)];
+			message.assign((const char*)slot.data, std::min<size_t>(slot.length, sizeof(slot.data)));
+			HandleMessage(message, stats);
+			stats.ring_messages++;
+		}
+		if (tail != ring->tail.load(std::memory_order_relaxed))
+		{
+			ring->tail.store(tail, std::memory_order_release);
+			ring->drained.fetch_add(1);
+			if (ring->helper_waiting.load() != 0)
+				GameLinkPlatform::WakeSignal(GameLinkPlatform::SIGNAL_DRAINED, &ring->drained);
+		}
+	}
+
+	Lock(shared);
+	const UINT16 payload = shm->buf_tohost.payload;
+	if (payload != 0)
+	{
+		message.assign((const char*)shm->buf_tohost.data, payload);
+		shm->buf_tohost.payload = 0;
+	}
+	for (int i = 0; i < 8; i++)
+	{
+		stats.key_changes += std::popcount(keyb_state[i] ^ shm->input_other.keyb_state[i]);
+		keyb_state[i] = shm->input_other.keyb_state[i];
+	}
+	pthread_mutex_unlock(&shared->mutex);
+	if (payload != 0)
+		HandleMessage(message, stats);
+}
+
+// A frame of moving bars, so that a few rows change from one frame to the next
+template <typename Frame>
+static void DrawFrame(Frame& frame, UINT16 seq)
+{
+	constexpr UINT16 width = 560;
+	constexpr UINT16 height = 384;
+	frame.width = width;
+	frame.height = height;
+	frame.image_fmt = 1;
+	frame.par_x = 1;
+	frame.par_y = 1;
+	UINT32* pixels = (UINT32*)frame.buffer;
+	const UINT16 bar = seq % height;
+	for (UINT16 y = 0; y < height; y++)
+	{
+		const UINT32 color = (y / 8 == bar / 8) ? 0xFFFFFFFF : (0xFF000000 | (y * 0x010101u / 2));
+		for (UINT16 x = 0; x < width; x++)
+			pixels[(size_t)y * width + x] = color;
+	}
+}
+
+static void WriteFrame(sSharedMemoryMap_R4* shm, sSharedMutex_Posix* shared, sSharedMMapFrames_R6* frames, UINT16 seq)
+{
+	if (frames)
+	{
+		// never the latest buffer, which readers may be copying
+		const UINT32 index = (frames->latest.load(std::memory_order_relaxed) + 1) % sSharedMMapFrames_R6::BUFFER_COUNT;
+		sSharedMMapFrames_R6::Buffer& buffer = frames->buffers[index];
+		const UINT32 buffer_seq = buffer.seq.load(std::memory_order_relaxed);
+		buffer.seq.store(buffer_seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		DrawFrame(buffer, seq);
+		buffer.frame_seq = seq;
+		buffer.seq.store(buffer_seq + 2, std::memory_order_release);
+		frames->latest.store(index, std::memory_order_release);
+	}
+
+	Lock(shared);
+	DrawFrame(shm->frame, seq);
+	shm->frame.seq = seq;
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+int main(int argc, char* argv[])
+{
+	double fps = 60;
+	long poll_us = 1000;
+	size_t ram_size = 128 * 1024;
+	UINT32 ring_slots = 8;
+	bool frame_buffers = true;
+	double seconds = 0;		// 0 runs until interrupted
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--fps")
+			fps = atof(argv[i + 1]);
+		else if (arg == "--frames")
+			frame_buffers = (atoi(argv[i + 1]) != 0);
+		else if (arg == "--poll-us")
+			poll_us = atol(argv[i + 1]);
+		else if (arg == "--ram")
+			ram_size = (size_t)atol(argv[i + 1]);
+		else if (arg == "--ring")
+			ring_slots = (UINT32)atol(argv[i + 1]);
+		else if (arg == "--seconds")
+			seconds = atof(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "Usage: %s [--fps N] [--frames 0|1] [--poll-us N] [--ram BYTES] [--ring SLOTS] [--seconds N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	auto shared = (sSharedMutex_Posix*)CreateObject(GAMELINK_POSIX_MUTEX_NAME, sizeof(sSharedMutex_Posix));
+	if (ring_slots & (ring_slots - 1))
+	{
+		fprintf(stderr, "--ring must be a power of 2\n");
+		return 1;
+	}
+	// the frame buffers go after the ring, so there are none without it
+	frame_buffers = frame_buffers && ring_slots;
+	const size_t ring_offset = sSharedMMapRing_R5::OffsetFor((UINT)ram_size);
+	const size_t frames_offset = sSharedMMapFrames_R6::OffsetFor((UINT)ram_size, ring_slots);
+	size_t map_size = sizeof(sSharedMemoryMap_R4) + ram_size;
+	if (frame_buffers)
+		map_size = frames_offset + sizeof(sSharedMMapFrames_R6);
+	else if (ring_slots)
+		map_size = ring_offset + sSharedMMapRing_R5::SizeFor(ring_slots);
+	auto shm = (sSharedMemoryMap_R4*)CreateObject(GAMELINK_POSIX_MMAP_NAME, map_size);
+	if (shared == nullptr || shm == nullptr || !InitMutex(shared))
+	{
+		fprintf(stderr, "Couldn't create the GameLink shared memory\n");
+		shm_unlink(GAMELINK_POSIX_MUTEX_NAME);
+		shm_unlink(GAMELINK_POSIX_MMAP_NAME);
+		return 1;
+	}
+	// the new objects are zeroed, which is every field's starting value but these
+	shm->version = PROTOCOL_VER;
+	snprintf(shm->system, sizeof(shm->system), "%s", SYSTEM_NAME);
+	snprintf(shm->program, sizeof(shm->program), "%s", "GameLinkServer");
+	shm->ram_size = (UINT)ram_size;
+	sSharedMMapRing_R5* ring = nullptr;
+	if (ring_slots)
+	{
+		ring = (sSharedMMapRing_R5*)((UINT8*)shm + ring_offset);
+		ring->slot_count = ring_slots;
+		ring->slot_size = sizeof(sSharedMMapRing_R5::Slot);
+		ring->magic = sSharedMMapRing_R5::MAGIC;
+		shm->version = PROTOCOL_VER_RING;
+	}
+	sSharedMMapFrames_R6* frames = nullptr;
+	if (frame_buffers)
+	{
+		frames = (sSharedMMapFrames_R6*)((UINT8*)shm + frames_offset);
+		frames->buffer_count = sSharedMMapFrames_R6::BUFFER_COUNT;
+		frames->buffer_size = sizeof(sSharedMMapFrames_R6::Buffer);
+		frames->magic = sSharedMMapFrames_R6::MAGIC;
+		shm->version = PROTOCOL_VER_FRAMES;
+	}
+
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+	printf("Serving %s, %zu bytes of RAM, %u ring slots, %s, %.0f fps\n", GAMELINK_POSIX_MMAP_NAME, ram_size, ring_slots,
+		frame_buffers ? "frame buffers" : "single frame", fps);
+
+	using clock = std::chrono::steady_clock;
+	const auto start = clock::now();
+	const auto frame_interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(fps > 0 ? 1.0 / fps : 1e9));
+	auto next_frame = start;
+	auto next_report = start + std::chrono::seconds(1);
+	UINT16 seq = 0;
+	std::string message;
+	sServerStats stats, reported;
+	while (!g_stop)
+	{
+		Drain(shm, shared, ring, message, stats);
+		const auto now = clock::now();
+		if (now >= next_frame)
+		{
+			WriteFrame(shm, shared, frames, ++seq);
+			stats.frames++;
+			next_frame += frame_interval;
+			if (next_frame < now)
+				next_frame = now + frame_interval;
+		}
+		if (now >= next_report)
+		{
+			printf("%zu msgs (%zu by ring), %zu writes (%zu malformed), %zu processes, %zu commands, %.2f MB/s, %zu frames, %zu key changes\n",
+				stats.messages - reported.messages, stats.ring_messages - reported.ring_messages, stats.writes - reported.writes, stats.malformed - reported.malformed,
+				stats.processes - reported.processes, stats.commands - reported.commands,
+				(stats.bytes - reported.bytes) / 1e6, stats.frames - reported.frames, stats.key_changes - reported.key_changes);
+			fflush(stdout);
+			reported = stats;
+			next_report += std::chrono::seconds(1);
+		}
+		if (seconds > 0 && now - start >= std::chrono::duration<double>(seconds))
+			break;
+		// the ring wakes us as soon as there's something in it, buf_tohost has to be polled
+		if (ring)
+		{
+			ring->server_waiting.fetch_add(1);
+			const UINT32 seen = ring->published.load();
+			if (ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed))
+				GameLinkPlatform::WaitSignal(GameLinkPlatform::SIGNAL_PUBLISHED, &ring->published, seen, (UINT32)poll_us);
+			ring->server_waiting.fetch_sub(1);
+		}
+		else if (poll_us > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(poll_us));
+		}
+	}
+
+	printf("Total: %zu msgs, %zu writes (%zu malformed), %zu processes, %zu other, %zu commands, %zu bytes, %zu frames, %zu key changes\n",
+		stats.messages, stats.writes, stats.malformed, stats.processes, stats.other, stats.commands, stats.bytes, stats.frames, stats.key_changes);
+	pthread_mutex_destroy(&shared->mutex);
+	shm_unlink(GAMELINK_POSIX_MUTEX_NAME);
+	shm_unlink(GAMELINK_POSIX_MMAP_NAME);
+	return 0;
+}
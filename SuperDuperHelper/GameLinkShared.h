@@ -0,0 +1,281 @@
+#pragma once
+
+#include "GameLink.h"
+
+/**
+ * @brief GameLink shared memory
+ * Layout of the mapping AppleWin shares with the helper, and the names both sides open it by.
+ * Used by the helper's GameLink and by the stand-in server, so it must stay byte for byte what AppleWin expects.
+*/
+
+//------------------------------------------------------------------------------
+// Definitions
+//------------------------------------------------------------------------------
+
+#define SYSTEM_NAME		"AppleWin"
+#define PROTOCOL_VER		4
+#define GAMELINK_MUTEX_NAME		"DWD_GAMELINK_MUTEX_R4"
+#define GAMELINK_MMAP_NAME		"DWD_GAMELINK_MMAP_R4"
+
+//------------------------------------------------------------------------------
+// Shared Memory Structure
+//------------------------------------------------------------------------------
+
+#pragma pack( push, 1 )
+
+	//
+	// sSharedMMapFrame_R1
+	//
+	// Server -> Client Frame. 32-bit RGBA up to MAX_WIDTH x MAX_HEIGHT
+	//
+struct sSharedMMapFrame_R1
+{
+	UINT16 seq;
+	UINT16 width;
+	UINT16 height;
+
+	UINT8 image_fmt; // 0 = no frame; 1 = 32-bit 0xAARRGGBB
+	UINT8 reserved0;
+
+	UINT16 par_x; // pixel aspect ratio
+	UINT16 par_y;
+
+	enum { MAX_WIDTH = 1280 };
+	enum { MAX_HEIGHT = 1024 };
+
+	enum { MAX_PAYLOAD = (int)MAX_WIDTH * (int)MAX_HEIGHT * 4 };
+	UINT8 buffer[MAX_PAYLOAD];
+};
+
+//
+// sSharedMMapInput_R2
+//
+// Client -> Server Input Data
+//
+
+struct sSharedMMapInput_R2
+{
+	float mouse_dx;
+	float mouse_dy;
+	UINT8 ready;
+	UINT8 mouse_btn;
+	UINT keyb_state[8];
+
+	enum { READY_NO = 0 };					// Input not ready
+	enum { READY_GC = 1 };					// Input from GC
+	enum { READY_OTHER = 17 };				// Input from other app
+};
+
+//
+// sSharedMMapPeek_R2
+//
+// Memory reading interface, an obsolete way of requesting RAM address values.
+// This is unnecessary now for reading RAM as the RAM is completely mapped at the end of the SHM
+// However we can use this interface to request processor registers!
+struct sSharedMMapPeek_R2
+{
+	enum { PEEK_SPECIAL_PC_H = UINT_MAX - 1 };	// Set this address to request program counter high byte
+	enum { PEEK_SPECIAL_PC_L = UINT_MAX - 2 };	// Set this address to request program counter low byte
+	enum { PEEK_LIMIT = 16 * 1024 };
+
+	UINT addr_count;
+	UINT addr[PEEK_LIMIT];
+	UINT8 data[PEEK_LIMIT];
+};
+
+//
+// sSharedMMapBuffer_R1
+//
+// General buffer (64Kb)
+//
+struct sSharedMMapBuffer_R1
+{
+	enum { BUFFER_SIZE = (64 * 1024) };
+
+	UINT16 payload;
+	UINT8 data[BUFFER_SIZE];
+};
+
+//
+// sSharedMMapAudio_R1
+//
+// Audio control interface.
+//
+struct sSharedMMapAudio_R1
+{
+	UINT8 master_vol_l;
+	UINT8 master_vol_r;
+};
+
+//
+// sSharedMemoryMap_R4
+//
+// Memory Map (top-level object)
+//
+
+constexpr int FLAG_WANT_KEYB = 1 << 0;
+constexpr int FLAG_WANT_MOUSE = 1 << 1;
+constexpr int FLAG_NO_FRAME = 1 << 2;
+constexpr int FLAG_PAUSED = 1 << 3;
+constexpr int SYSTEM_MAXLEN = 64;
+constexpr int PROGRAM_MAXLEN = 260;
+
+struct sSharedMemoryMap_R4
+{
+	UINT8 version; // = PROTOCOL_VER
+	UINT8 flags;
+	char system[SYSTEM_MAXLEN] = {}; // System name.
+	char program[PROGRAM_MAXLEN] = {}; // Program name. Zero terminated.
+	UINT program_hash[4] = { 0,0,0,0 }; // Program code hash (256-bits)
+
+	sSharedMMapFrame_R1 frame;
+	sSharedMMapInput_R2 input;
+	sSharedMMapPeek_R2 peek;
+	sSharedMMapBuffer_R1 buf_tohost;
+	sSharedMMapBuffer_R1 buf_recv; // a message to us.
+	sSharedMMapAudio_R1 audio;
+
+	// added for protocol v4
+	UINT ram_size;
+
+	// added a simpler, other input channel that isn't clobbered by gridcarto
+	sSharedMMapInput_R2 input_other;
+};
+
+#pragma pack( pop )
+
+#ifndef _WIN32
+#include <pthread.h>
+
+//
+// sSharedMutex_Posix
+//
+// Stands in for the named Windows mutex: a robust, process-shared mutex alone in its own
+// shared memory object named GAMELINK_MUTEX_NAME, so the frame layout above is left untouched.
+// Whoever creates the mapping initializes it.
+//
+struct sSharedMutex_Posix
+{
+	pthread_mutex_t mutex;
+};
+
+// POSIX shared memory object names need the leading slash
+#define GAMELINK_POSIX_MUTEX_NAME	"/" GAMELINK_MUTEX_NAME
+#define GAMELINK_POSIX_MMAP_NAME	"/" GAMELINK_MMAP_NAME
+#endif
+
+//------------------------------------------------------------------------------
+// Command Ring (protocol v5)
+//------------------------------------------------------------------------------
+
+#include <atomic>
+
+#define PROTOCOL_VER_RING	5
+#define GAMELINK_PUBLISHED_EVENT_NAME	"DWD_GAMELINK_PUBLISHED_R5"
+#define GAMELINK_DRAINED_EVENT_NAME		"DWD_GAMELINK_DRAINED_R5"
+
+//
+// sSharedMMapRing_R5
+//
+// Client -> Server messages, the same as in buf_tohost, in a single producer single consumer ring
+// of slot_count slots. A server that has one sets version to PROTOCOL_VER_RING, and puts it
+// right after the RAM, aligned to RING_ALIGN. Clients that don't know about it keep using buf_tohost.
+//
+// The helper writes slot (head % slot_count) and then publishes it by bumping head;
+// the server reads slots up to head and then frees them by bumping tail. Nobody takes the mutex.
+//
+// Neither side has to poll for the other. After moving head, the helper bumps published and,
+// if server_waiting isn't 0, wakes the server's SIGNAL_PUBLISHED; after moving tail, the server bumps
+// drained and, if helper_waiting isn't 0, wakes the helper's SIGNAL_DRAINED. On Windows the signals are
+// auto-reset events named GAMELINK_PUBLISHED_EVENT_NAME and GAMELINK_DRAINED_EVENT_NAME,
+// elsewhere futexes on the counters themselves. Whoever waits raises its waiting count first,
+// reads the counter, checks the ring once more and only then blocks, so that no wake is lost.
+//
+struct sSharedMMapRing_R5
+{
+	enum : UINT32 { MAGIC = 0x47524453 };	// "SDRG"
+	enum { RING_ALIGN = 64 };
+
+	struct Slot
+	{
+		UINT32 length;			// of the message in data
+		UINT32 reserved;
+		UINT8 data[sSharedMMapBuffer_R1::BUFFER_SIZE];
+	};
+
+	UINT32 magic;
+	UINT32 slot_count;			// a power of 2
+	UINT32 slot_size;			// sizeof(Slot), for a check
+	UINT32 reserved;
+
+	alignas(RING_ALIGN) std::atomic<UINT64> head;	// messages published by the helper
+	std::atomic<UINT32> published;					// bumped after head moves
+	std::atomic<UINT32> server_waiting;				// servers blocked on published
+	alignas(RING_ALIGN) std::atomic<UINT64> tail;	// messages the server is done with
+	std::atomic<UINT32> drained;					// bumped after tail moves
+	std::atomic<UINT32> helper_waiting;				// helpers blocked on drained
+	alignas(RING_ALIGN) Slot slots[1];				// slot_count of them
+
+	static size_t SizeFor(UINT32 slot_count) { return offsetof(sSharedMMapRing_R5, slots) + (size_t)slot_count * sizeof(Slot); };
+	// Where the ring starts, from the start of the mapping
+	static size_t OffsetFor(UINT ram_size)
+	{
+		return (sizeof(sSharedMemoryMap_R4) + ram_size + RING_ALIGN - 1) & ~(size_t)(RING_ALIGN - 1);
+	};
+};
+static_assert(std::atomic<UINT64>::is_always_lock_free && std::atomic<UINT32>::is_always_lock_free,
+	"the ring's counters are shared between processes");
+
+//------------------------------------------------------------------------------
+// Frame Buffers (protocol v6)
+//------------------------------------------------------------------------------
+
+#define PROTOCOL_VER_FRAMES	6
+
+//
+// sSharedMMapFrames_R6
+//
+// Server -> Client frames, like sSharedMMapFrame_R1 but read without the mutex. A server that has them
+// sets version to PROTOCOL_VER_FRAMES, has the command ring of v5, and puts them right after the ring,
+// aligned to FRAMES_ALIGN. It keeps writing the v4 frame as well, for clients that don't know about these.
+//
+// There are BUFFER_COUNT buffers, each behind a seqlock. The server writes a buffer other than latest:
+// it makes its seq odd, writes the frame, makes seq even again and then points latest at it.
+// The client reads seq, copies the frame out of buffer latest, and reads seq again. If seq was odd
+// or has moved, the server wrote over the frame while it was being copied, and the client copies again.
+// Neither side ever waits for the other.
+//
+struct sSharedMMapFrames_R6
+{
+	enum : UINT32 { MAGIC = 0x42464453 };	// "SDFB"
+	enum { FRAMES_ALIGN = 64 };
+	enum { BUFFER_COUNT = 3 };
+
+	struct Buffer
+	{
+		alignas(FRAMES_ALIGN) std::atomic<UINT32> seq;	// odd while the server writes the buffer
+		UINT16 frame_seq;			// the v4 frame's seq of this frame
+		UINT16 width;
+		UINT16 height;
+		UINT8 image_fmt;			// 0 = no frame; 1 = 32-bit 0xAARRGGBB
+		UINT8 reserved0;
+		UINT16 par_x;				// pixel aspect ratio
+		UINT16 par_y;
+		alignas(FRAMES_ALIGN) UINT8 buffer[sSharedMMapFrame_R1::MAX_PAYLOAD];
+	};
+
+	UINT32 magic;
+	UINT32 buffer_count;		// BUFFER_COUNT
+	UINT32 buffer_size;			// sizeof(Buffer), for a check
+	UINT32 reserved;
+
+	alignas(FRAMES_ALIGN) std::atomic<UINT32> latest;	// the buffer with the newest complete frame
+	Buffer buffers[BUFFER_COUNT];
+
+	// Where the buffers start, from the start of the mapping, after a ring of slot_count slots
+	static size_t OffsetFor(UINT ram_size, UINT32 slot_count)
+	{
+		const size_t ring_end = sSharedMMapRing_R5::OffsetFor(ram_size) + sSharedMMapRing_R5::SizeFor(slot_count);
+		return (ring_end + FRAMES_ALIGN - 1) & ~(size_t)(FRAMES_ALIGN - 1);
+	};
+};
@@ -1,10 +1,122 @@
 #include "ImageHelper.h"
+#include <SDL.h>
+#include <cstdio>
+#include <cstring>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGEHELPER_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define IMAGEHELPER_NEON
+#endif
+
+// Pixel buffer objects need the desktop GL; GLES2 and WebGL upload from memory
+#if !defined(IMGUI_IMPL_OPENGL_ES2) && !defined(__EMSCRIPTEN__)
+#define IMAGEHELPER_USE_PBO 1
+#endif
+
+#ifdef IMAGEHELPER_USE_PBO
+// The GL entry points past 1.1 that streaming needs, which SDL_opengl.h doesn't declare everywhere.
+// Looked up once, with the first context.
+struct StreamingFunctions
+{
+	PFNGLGENBUFFERSPROC GenBuffers = nullptr;
+	PFNGLDELETEBUFFERSPROC DeleteBuffers = nullptr;
+	PFNGLBINDBUFFERPROC BindBuffer = nullptr;
+	PFNGLBUFFERDATAPROC BufferData = nullptr;
+	PFNGLMAPBUFFERRANGEPROC MapBufferRange = nullptr;
+	PFNGLUNMAPBUFFERPROC UnmapBuffer = nullptr;
+	PFNGLFENCESYNCPROC FenceSync = nullptr;
+	PFNGLCLIENTWAITSYNCPROC ClientWaitSync = nullptr;
+	PFNGLDELETESYNCPROC DeleteSync = nullptr;
+	PFNGLTEXSTORAGE2DPROC TexStorage2D = nullptr;
+	bool buffers = false;	// GL 3.0 pixel buffers and glMapBufferRange
+	bool sync = false;		// GL 3.2 fences
+	bool storage = false;	// GL 4.2 immutable storage
+};
+
+static const StreamingFunctions& GetStreamingFunctions()
+{
+	static const StreamingFunctions functions = []() {
+		StreamingFunctions f;
+		int major = 0, minor = 0;
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if (version == nullptr || sscanf(version, "%d.%d", &major, &minor) != 2)
+			return f;
+		const int gl_version = major * 10 + minor;
+		f.GenBuffers = (PFNGLGENBUFFERSPROC)SDL_GL_GetProcAddress("glGenBuffers");
+		f.DeleteBuffers = (PFNGLDELETEBUFFERSPROC)SDL_GL_GetProcAddress("glDeleteBuffers");
+		f.BindBuffer = (PFNGLBINDBUFFERPROC)SDL_GL_GetProcAddress("glBindBuffer");
+		f.BufferData = (PFNGLBUFFERDATAPROC)SDL_GL_GetProcAddress("glBufferData");
+		f.MapBufferRange = (PFNGLMAPBUFFERRANGEPROC)SDL_GL_GetProcAddress("glMapBufferRange");
+		f.UnmapBuffer = (PFNGLUNMAPBUFFERPROC)SDL_GL_GetProcAddress("glUnmapBuffer");
+		f.buffers = (gl_version >= 30) && f.GenBuffers && f.DeleteBuffers && f.BindBuffer && f.BufferData && f.MapBufferRange && f.UnmapBuffer;
+		f.FenceSync = (PFNGLFENCESYNCPROC)SDL_GL_GetProcAddress("glFenceSync");
+		f.ClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)SDL_GL_GetProcAddress("glClientWaitSync");
+		f.DeleteSync = (PFNGLDELETESYNCPROC)SDL_GL_GetProcAddress("glDeleteSync");
+		f.sync = f.buffers && (gl_version >= 32 || SDL_GL_ExtensionSupported("GL_ARB_sync")) && f.FenceSync && f.ClientWaitSync && f.DeleteSync;
+		f.TexStorage2D = (PFNGLTEXSTORAGE2DPROC)SDL_GL_GetProcAddress("glTexStorage2D");
+		f.storage = (gl_version >= 42 || SDL_GL_ExtensionSupported("GL_ARB_texture_storage")) && f.TexStorage2D;
+		return f;
+	}();
+	return functions;
+}
+#endif
+
+static bool RowsEqual(const uint8_t* a, const uint8_t* b, size_t length)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+		if ((uint32_t)_mm256_movemask_epi8(eq) != 0xFFFFFFFFu)
+			return false;
+	}
+#elif defined(IMAGEHELPER_SSE2)
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			return false;
+	}
+#elif defined(IMAGEHELPER_NEON)
+	for (; i + 16 <= length; i += 16)
+	{
+		if (vmaxvq_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0)
+			return false;
+	}
+#endif
+	return memcmp(a + i, b + i, length - i) == 0;
+}
+
 namespace ImageHelper
 {
+	int DiffRows(uint8_t* prev, const uint8_t* next, size_t row_bytes, int rows, int merge_gap, std::vector<RowSpan>& spans)
+	{
+		int changed = 0;
+		for (int y = 0; y < rows; y++)
+		{
+			const size_t offset = (size_t)y * row_bytes;
+			if (RowsEqual(prev + offset, next + offset, row_bytes))
+				continue;
+			memcpy(prev + offset, next + offset, row_bytes);
+			changed++;
+			// uploading a few unchanged rows is cheaper than another glTexSubImage2D()
+			if (!spans.empty() && y - (spans.back().first + spans.back().count) <= merge_gap)
+				spans.back().count = y + 1 - spans.back().first;
+			else
+				spans.push_back({ y, 1 });
+		}
+		return changed;
+	}
+
 	// Simple helper function to load an image into a OpenGL texture with common settings
 	bool LoadTextureFromFile(const char* filename, GLuint* out_texture, int* out_width, int* out_height)
 	{
@@ -52,6 +164,220 @@ namespace ImageHelper
 		return true;
 	}
 
+	//////////////////////////////////////////////////////////////////////////
+	// StreamingTexture
+	//////////////////////////////////////////////////////////////////////////
+
+	bool StreamingTexture::Allocate(int new_width, int new_height)
+	{
+		if (texture != 0)
+			glDeleteTextures(1, &texture);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		width = new_width;
+		height = new_height;
+		const size_t size = (size_t)width * height * 4;
+
+#ifdef IMAGEHELPER_USE_PBO
+		const StreamingFunctions& f = GetStreamingFunctions();
+		if (f.storage)
+			f.TexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		if (f.buffers)
+		{
+			if (pbos[0] == 0)
+				f.GenBuffers(PBO_COUNT, pbos);
+			for (int i = 0; i < PBO_COUNT; i++)
+			{
+				if (fences[i])
+				{
+					f.DeleteSync((GLsync)fences[i]);
+					fences[i] = nullptr;
+				}
+				f.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+				f.BufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+			}
+			f.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+#else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#endif
+		// the new texture holds nothing the shadow could be diffed against
+		shadow_valid = false;
+		stats.reallocations++;
+		return true;
+	}
+
+	bool StreamingTexture::Update(const unsigned char* pixels, int new_width, int new_height, bool isARGB)
+	{
+		if (pixels == nullptr || new_width <= 0 || new_height <= 0)
+			return false;
+		const Uint64 start = SDL_GetPerformanceCounter();
+		if (texture == 0 || new_width != width || new_height != height)
+			Allocate(new_width, new_height);
+
+		const size_t row_bytes = (size_t)width * 4;
+		const size_t size = row_bytes * height;
+		v_spans.clear();
+		if (partial && shadow_valid && shadow_argb == isARGB)
+		{
+			DiffRows(v_shadow.data(), pixels, row_bytes, height, PARTIAL_MERGE_GAP, v_spans);
+		}
+		else
+		{
+			v_spans.push_back({ 0, height });
+			if (partial)
+			{
+				v_shadow.assign(pixels, pixels + size);
+				shadow_valid = true;
+				shadow_argb = isARGB;
+			}
+		}
+
+		size_t changed = 0;
+		for (const RowSpan& span : v_spans)
+			changed += row_bytes * span.count;
+		if (changed == 0)
+			stats.clean_frames++;
+		else
+			Upload(pixels, isARGB);
+		if (changed != 0 && changed != size)
+			stats.partial_uploads++;
+		stats.uploads++;
+		stats.bytes += changed;
+		stats.last_changed_bytes = changed;
+		stats.last_upload_seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		stats.total_upload_seconds += stats.last_upload_seconds;
+		return true;
+	}
+
+	void StreamingTexture::Upload(const unsigned char* pixels, bool isARGB)
+	{
+		const size_t row_bytes = (size_t)width * 4;
+		const size_t size = row_bytes * height;
+		const GLenum format = isARGB ? GL_BGRA : GL_RGBA;
+		const GLenum type = isARGB ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE;
+		glBindTexture(GL_TEXTURE_2D, texture);
+#if defined(GL_UNPACK_ROW_LENGTH) && !defined(__EMSCRIPTEN__)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+
+#ifdef IMAGEHELPER_USE_PBO
+		const StreamingFunctions& f = GetStreamingFunctions();
+		if (f.buffers)
+		{
+			const int i = next_pbo;
+			next_pbo = (next_pbo + 1) % PBO_COUNT;
+			f.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+
+			// With PBO_COUNT buffers in turn, the GPU is normally long done with this one.
+			// If it isn't, or there's no fence to tell, the buffer gets fresh storage rather than a wait.
+			bool idle = false;
+			if (fences[i])
+			{
+				const GLenum status = f.ClientWaitSync((GLsync)fences[i], 0, 0);
+				idle = (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED);
+				f.DeleteSync((GLsync)fences[i]);
+				fences[i] = nullptr;
+			}
+			else
+			{
+				// with fences, a buffer without one hasn't been read since it got its storage
+				idle = f.sync;
+			}
+			GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+			if (idle)
+			{
+				access |= GL_MAP_UNSYNCHRONIZED_BIT;
+			}
+			else
+			{
+				f.BufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+				stats.orphaned++;
+			}
+
+			// the changed rows go where they sit in the frame, the rest of the buffer is left undefined
+			void* mapped = f.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size, access);
+			if (mapped)
+			{
+				for (const RowSpan& span : v_spans)
+				{
+					const size_t offset = row_bytes * span.first;
+					memcpy((uint8_t*)mapped + offset, pixels + offset, row_bytes * span.count);
+				}
+				// GL_FALSE means the buffer got lost while mapped, and the frame with it
+				if (f.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+				{
+					for (const RowSpan& span : v_spans)
+						glTexSubImage2D(GL_TEXTURE_2D, 0, 0, span.first, width, span.count, format, type, (const void*)(row_bytes * span.first));
+					if (f.sync)
+						fences[i] = f.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				}
+				else
+				{
+					// the shadow holds rows the texture never got
+					shadow_valid = false;
+				}
+				f.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				return;
+			}
+			f.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+#endif
+		for (const RowSpan& span : v_spans)
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, span.first, width, span.count, format, type, pixels + row_bytes * span.first);
+		stats.direct_uploads++;
+	}
+
+	bool StreamingTexture::UpdateFrame(uint32_t frame, const unsigned char* pixels, int new_width, int new_height, bool isARGB)
+	{
+		if (has_frame && frame == last_frame && texture != 0 && new_width == width && new_height == height)
+		{
+			stats.skipped++;
+			return false;
+		}
+		if (!Update(pixels, new_width, new_height, isARGB))
+			return false;
+		has_frame = true;
+		last_frame = frame;
+		return true;
+	}
+
+	void StreamingTexture::Release()
+	{
+#ifdef IMAGEHELPER_USE_PBO
+		if (pbos[0] != 0)
+		{
+			const StreamingFunctions& f = GetStreamingFunctions();
+			for (int i = 0; i < PBO_COUNT; i++)
+			{
+				if (fences[i])
+				{
+					f.DeleteSync((GLsync)fences[i]);
+					fences[i] = nullptr;
+				}
+			}
+			f.DeleteBuffers(PBO_COUNT, pbos);
+			memset(pbos, 0, sizeof(pbos));
+		}
+#endif
+		if (texture != 0)
+		{
+			glDeleteTextures(1, &texture);
+			texture = 0;
+		}
+		width = 0;
+		height = 0;
+		next_pbo = 0;
+		has_frame = false;
+		shadow_valid = false;
+	}
+
 	void convertRGB888toRGB555(const uint8_t* rgb888_buffer, int width, int height, uint16_t* rgb555_buffer) {
 		size_t num_pixels = (size_t)width * height;
 
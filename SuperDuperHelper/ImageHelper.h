@@ -4,12 +4,105 @@
 #else
 #include <SDL_opengl.h>
 #endif
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
 namespace ImageHelper
 {
 	bool LoadTextureFromFile(const char* filename, GLuint* out_texture, int* out_width, int* out_height);
 	bool LoadTextureFromMemory(const unsigned char* image_data, GLuint* out_texture, const int image_width, const int image_height, bool isARGB = false);
 	void convertRGB888toRGB555(const uint8_t* rgb888_buffer, int width, int height, uint16_t* rgb555_buffer);
+
+	// Rows [first, first + count) of a frame
+	struct RowSpan
+	{
+		int first;
+		int count;
+	};
+
+	// Compares a frame against the previous one, row by row with the widest SIMD compiled in (AVX2, SSE2 or NEON),
+	// and copies the rows that differ into prev, so it becomes the new frame.
+	// The rows that differ are appended to spans, merged across gaps of up to merge_gap unchanged rows.
+	// Returns the number of rows that differ.
+	int DiffRows(uint8_t* prev, const uint8_t* next, size_t row_bytes, int rows, int merge_gap, std::vector<RowSpan>& spans);
+
+	/**
+	 * @brief StreamingTextureStats
+	 * What a StreamingTexture did since it was created
+	*/
+	struct StreamingTextureStats
+	{
+		size_t uploads = 0;
+		size_t skipped = 0;				// UpdateFrame() calls for a frame that was already up
+		size_t reallocations = 0;		// texture storage (re)created, on the first frame and size changes
+		size_t orphaned = 0;			// pixel buffers the GPU still used, given fresh storage instead of waiting
+		size_t direct_uploads = 0;		// without pixel buffers, when the GL doesn't have them
+		size_t bytes = 0;				// uploaded, only the changed rows of partial updates
+		size_t partial_uploads = 0;		// uploads of the changed rows only
+		size_t clean_frames = 0;		// partial updates that found no changed row, and uploaded nothing
+		size_t last_changed_bytes = 0;	// of the last Update()
+		double last_upload_seconds = 0;	// CPU time of the last Update(), diff included
+		double total_upload_seconds = 0;
+	};
+
+	/**
+	 * @brief StreamingTexture
+	 * A texture that gets new pixels every frame, like the emulator's video.
+	 * Its storage is allocated once, immutable where the GL has glTexStorage2D, and only made again when the size changes.
+	 * Frames go through PBO_COUNT pixel buffer objects in turn, so the CPU copies into one while the GPU
+	 * still reads from the others, and glTexSubImage2D() picks them up without the CPU waiting on the GPU.
+	 * Without buffer objects (GLES2, WebGL) it falls back to glTexSubImage2D() from memory, into the same texture.
+	 * With partial updates on, it keeps a copy of the last frame and uploads only the bands of rows that changed.
+	 * Must be used and released on the thread that has the GL context.
+	*/
+	class StreamingTexture
+	{
+	public:
+		enum { PBO_COUNT = 3 };
+		// Unchanged rows between two changed ones that partial updates upload anyway, rather than split the upload
+		enum { PARTIAL_MERGE_GAP = 4 };
+
+		StreamingTexture() {};
+		~StreamingTexture() { Release(); };
+		StreamingTexture(const StreamingTexture&) = delete;
+		StreamingTexture& operator=(const StreamingTexture&) = delete;
+
+		// Uploads a frame of width * height 32-bit pixels, 0xAARRGGBB if isARGB, RGBA bytes otherwise
+		bool Update(const unsigned char* pixels, int width, int height, bool isARGB = false);
+		// Like Update(), for sources that number their frames: nothing is uploaded while frame
+		// and the size stay the same. Returns true if it uploaded.
+		bool UpdateFrame(uint32_t frame, const unsigned char* pixels, int width, int height, bool isARGB = false);
+		// Makes the next UpdateFrame() upload, whatever its frame number
+		void ForgetFrame() { has_frame = false; };
+		// Diffs each frame against the last one and uploads only the rows that changed. Off until set.
+		void SetPartialUpdates(bool enabled) { partial = enabled; shadow_valid = false; };
+		// Deletes the texture and the buffers; the next Update() makes them again
+		void Release();
+
+		GLuint GetTexture() const { return texture; };
+		int GetWidth() const { return width; };
+		int GetHeight() const { return height; };
+		const StreamingTextureStats& GetStats() const { return stats; };
+
+	private:
+		bool Allocate(int width, int height);
+		void Upload(const unsigned char* pixels, bool isARGB);
+
+		GLuint texture = 0;
+		int width = 0;
+		int height = 0;
+		GLuint pbos[PBO_COUNT] = {};
+		void* fences[PBO_COUNT] = {};	// GLsync of the upload that last read each buffer
+		int next_pbo = 0;
+		bool has_frame = false;
+		uint32_t last_frame = 0;
+		bool partial = false;
+		bool shadow_valid = false;		// v_shadow holds what the texture holds
+		bool shadow_argb = false;
+		std::vector<uint8_t> v_shadow;
+		std::vector<RowSpan> v_spans;	// of the frame being uploaded
+		StreamingTextureStats stats;
+	};
 };
 
@@ -0,0 +1,384 @@
+#include "SDHRAtlas.h"
+#include "SDHRHash.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+// imgui keeps its copy of the packer static to imgui_draw.cpp, so the one the atlas links against is built here.
+// Not static itself, or the parts the atlas doesn't call would warn as unused.
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
+int SDHRAtlasBuilder::AddSheet(const uint8_t* rgba, int width, int height, uint8_t xdim, uint8_t ydim, int tile_count)
+{
+	if (xdim == 0 || ydim == 0)
+		return -1;
+	const int columns = width / xdim;
+	const int available = columns * (height / ydim);
+	if (tile_count <= 0 || tile_count > available)
+		tile_count = available;
+	if (tile_count == 0)
+		return -1;
+
+	const int first = (int)v_sources.size();
+	for (int done = 0; done < tile_count; done += 256)
+	{
+		Source source;
+		source.xdim = xdim;
+		source.ydim = ydim;
+		source.tile_count = std::min(256, tile_count - done);
+		source.tiles.width = xdim;
+		source.tiles.height = source.tile_count * ydim;
+		source.tiles.rgba.resize((size_t)source.tiles.width * source.tiles.height * 4);
+		for (int t = 0; t < source.tile_count; t++)
+		{
+			const int x = ((done + t) % columns) * xdim;
+			const int y = ((done + t) / columns) * ydim;
+			for (int row = 0; row < ydim; row++)
+				memcpy(source.tiles.rgba.data() + ((size_t)t * ydim + row) * xdim * 4, rgba + ((size_t)(y + row) * width + x) * 4, (size_t)xdim * 4);
+		}
+		v_sources.push_back(std::move(source));
+	}
+	packed = false;
+	return first;
+}
+
+int SDHRAtlasBuilder::AddSheetFile(const std::string& path, uint8_t xdim, uint8_t ydim, int tile_count)
+{
+	int width = 0;
+	int height = 0;
+	unsigned char* rgba = stbi_load(path.c_str(), &width, &height, NULL, 4);
+	if (rgba == NULL)
+	{
+		OutputDebugStringW(L"ERROR: Couldn't load the sprite sheet!\n");
+		return -1;
+	}
+	int first = AddSheet(rgba, width, height, xdim, ydim, tile_count);
+	stbi_image_free(rgba);
+	return first;
+}
+
+bool SDHRAtlasBuilder::Pack()
+{
+	v_atlases.clear();
+	v_tilesets.assign(v_sources.size(), SDHRAtlasTileset());
+	packed = false;
+	stats = SDHRAtlasStats();
+	if (v_sources.empty())
+		return true;
+
+	std::vector<std::vector<int>> v_entry_cells(v_sources.size());
+	std::vector<std::vector<int>> v_cell_tiles(v_sources.size());
+	for (size_t i = 0; i < v_sources.size(); i++)
+		SelectTiles(v_sources[i], v_tilesets[i], v_entry_cells[i], v_cell_tiles[i]);
+
+	// blocks are placed on a grid fine enough for all the tile sizes
+	int grid_x = 1;
+	int grid_y = 1;
+	for (auto& source : v_sources)
+	{
+		grid_x = std::lcm(grid_x, (int)source.xdim);
+		grid_y = std::lcm(grid_y, (int)source.ydim);
+	}
+	const int cells_x = max_width / grid_x;
+	const int cells_y = max_height / grid_y;
+
+	// roughly square blocks, or as square as the atlas width allows, as wide as their rounded up width allows
+	std::vector<int> v_columns(v_sources.size());
+	std::vector<stbrp_rect> v_rects(v_sources.size());
+	for (size_t i = 0; i < v_sources.size(); i++)
+	{
+		const Source& source = v_sources[i];
+		const int cells = (int)v_cell_tiles[i].size();
+		int columns = (int)std::ceil(std::sqrt((double)cells * source.ydim / source.xdim));
+		columns = std::max(1, std::min(columns, cells_x * grid_x / source.xdim));
+		int width = (columns * source.xdim + grid_x - 1) / grid_x;
+		columns = std::min(width * grid_x / source.xdim, cells);
+		const int rows = (cells + columns - 1) / columns;
+		v_columns[i] = columns;
+		v_rects[i].id = (int)i;
+		v_rects[i].w = width;
+		v_rects[i].h = (rows * source.ydim + grid_y - 1) / grid_y;
+		if (v_rects[i].w > cells_x || v_rects[i].h > cells_y)
+		{
+			OutputDebugStringW(L"ERROR: SDHR tileset doesn't fit in an atlas!\n");
+			return false;
+		}
+	}
+
+	// fill one atlas with as many blocks as fit, then the next with the rest
+	std::vector<stbrp_node> v_nodes(cells_x);
+	std::vector<stbrp_rect> v_left = v_rects;
+	while (!v_left.empty())
+	{
+		stbrp_context context;
+		stbrp_init_target(&context, cells_x, cells_y, v_nodes.data(), (int)v_nodes.size());
+		stbrp_pack_rects(&context, v_left.data(), (int)v_left.size());
+
+		SDHRAtlasImage atlas;
+		for (auto& rect : v_left)
+		{
+			if (!rect.was_packed)
+				continue;
+			atlas.width = std::max(atlas.width, (rect.x + rect.w) * grid_x);
+			atlas.height = std::max(atlas.height, (rect.y + rect.h) * grid_y);
+		}
+		atlas.rgba.assign((size_t)atlas.width * atlas.height * 4, 0);
+
+		std::vector<stbrp_rect> v_next;
+		for (auto& rect : v_left)
+		{
+			if (!rect.was_packed)
+			{
+				v_next.push_back(rect);
+				continue;
+			}
+			const Source& source = v_sources[rect.id];
+			SDHRAtlasTileset& tileset = v_tilesets[rect.id];
+			tileset.atlas = v_atlases.size();
+			tileset.xdim = source.xdim;
+			tileset.ydim = source.ydim;
+			const int tile_x = rect.x * grid_x / source.xdim;
+			const int tile_y = rect.y * grid_y / source.ydim;
+			const int columns = v_columns[rect.id];
+			const std::vector<int>& v_tiles = v_cell_tiles[rect.id];
+			for (size_t cell = 0; cell < v_tiles.size(); cell++)
+			{
+				const int x = (tile_x + (int)cell % columns) * source.xdim;
+				const int y = (tile_y + (int)cell / columns) * source.ydim;
+				for (int line = 0; line < source.ydim; line++)
+					memcpy(atlas.rgba.data() + ((size_t)(y + line) * atlas.width + x) * 4,
+						source.tiles.rgba.data() + ((size_t)v_tiles[cell] * source.ydim + line) * source.xdim * 4, (size_t)source.xdim * 4);
+			}
+			for (int cell : v_entry_cells[rect.id])
+			{
+				tileset.entries.push_back((uint16_t)(tile_x + cell % columns));
+				tileset.entries.push_back((uint16_t)(tile_y + cell / columns));
+			}
+		}
+		v_atlases.push_back(std::move(atlas));
+		v_left.swap(v_next);
+	}
+	packed = true;
+	return true;
+}
+
+void SDHRAtlasBuilder::SelectTiles(const Source& source, SDHRAtlasTileset& tileset, std::vector<int>& v_entry_cells, std::vector<int>& v_cell_tiles)
+{
+	const size_t tile_bytes = (size_t)source.xdim * source.ydim * 4;
+	auto tile = [&](int t) { return source.tiles.rgba.data() + t * tile_bytes; };
+	std::unordered_multimap<uint64_t, int> cells_by_hash;		// hash of the tile -> cell holding it
+	// the cell holding the same pixels as the tile, adding one if there's none
+	auto find_cell = [&](int t) {
+		const uint64_t hash = SDHRHash(tile(t), tile_bytes);
+		if (dedupe || trim)
+		{
+			auto range = cells_by_hash.equal_range(hash);
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				if (memcmp(tile(v_cell_tiles[it->second]), tile(t), tile_bytes) == 0)
+				{
+					stats.duplicates++;
+					return it->second;
+				}
+			}
+		}
+		const int cell = (int)v_cell_tiles.size();
+		v_cell_tiles.push_back(t);
+		cells_by_hash.emplace(hash, cell);
+		return cell;
+	};
+
+	stats.tiles += source.tile_count;
+	if (!trim)
+	{
+		// every tile keeps its index
+		for (int t = 0; t < source.tile_count; t++)
+			v_entry_cells.push_back(find_cell(t));
+	}
+	else
+	{
+		// used tiles are renumbered in order, identical ones sharing the same number
+		std::vector<int> v_cell_entries;		// entry of each cell
+		for (int t = 0; t < source.tile_count; t++)
+		{
+			if (!source.used[t])
+			{
+				stats.unused++;
+				continue;
+			}
+			const int cell = find_cell(t);
+			if (cell == (int)v_cell_entries.size())
+			{
+				v_cell_entries.push_back((int)v_entry_cells.size());
+				v_entry_cells.push_back(cell);
+			}
+			tileset.remap[t] = (uint8_t)v_cell_entries[cell];
+		}
+		// a tileset nothing uses still needs an entry to be defined
+		if (v_entry_cells.empty())
+			v_entry_cells.push_back(find_cell(0));
+	}
+	stats.cells += v_cell_tiles.size();
+	stats.entries += v_entry_cells.size();
+}
+
+void SDHRAtlasBuilder::MarkUsed(const uint8_t* map, size_t tile_count, uint8_t first_tileset)
+{
+	for (size_t i = 0; i < tile_count; i++)
+	{
+		const size_t tileset = (size_t)(uint8_t)(map[i * 2] - first_tileset);
+		if (tileset < v_sources.size() && map[i * 2 + 1] < v_sources[tileset].tile_count)
+			v_sources[tileset].used[map[i * 2 + 1]] = true;
+	}
+	trim = true;
+	packed = false;
+}
+
+bool SDHRAtlasBuilder::RemapMap(uint8_t* map, size_t tile_count, uint8_t first_tileset) const
+{
+	if (!packed || !trim)
+		return false;
+	for (size_t i = 0; i < tile_count; i++)
+	{
+		const size_t tileset = (size_t)(uint8_t)(map[i * 2] - first_tileset);
+		if (tileset < v_tilesets.size())
+			map[i * 2 + 1] = v_tilesets[tileset].remap[map[i * 2 + 1]];
+	}
+	return true;
+}
+
+bool SDHRAtlasBuilder::Emit(SDHRCommandBatcher& batcher, SDHRUploadAllocator& upload_memory, uint8_t first_asset, uint8_t first_tileset) const
+{
+	if (!packed || first_asset + v_atlases.size() > 256 || first_tileset + v_tilesets.size() > 256)
+	{
+		OutputDebugStringW(L"ERROR: SDHR atlas isn't packed, or there aren't enough asset or tileset indexes for it!\n");
+		return false;
+	}
+	for (size_t i = 0; i < v_atlases.size(); i++)
+	{
+		const SDHRAtlasImage& atlas = v_atlases[i];
+		const std::vector<uint8_t> png = EncodePNG(atlas.rgba.data(), atlas.width, atlas.height);
+		const uint8_t asset_index = (uint8_t)(first_asset + i);
+		const SDHRUploadRegion* region = upload_memory.Upload(batcher, "atlas" + std::to_string(asset_index), png.data(), png.size());
+		if (region == nullptr)
+			return false;
+		DefineImageAssetCmd asset;
+		asset.asset_index = asset_index;
+		asset.upload_addr_med = region->AddrMed();
+		asset.upload_addr_high = region->AddrHigh();
+		asset.upload_page_count = (uint16_t)((png.size() + SDHR_UPLOAD_PAGE_SIZE - 1) / SDHR_UPLOAD_PAGE_SIZE);
+		if (!batcher.Add(asset))
+			return false;
+	}
+	for (size_t i = 0; i < v_tilesets.size(); i++)
+	{
+		const SDHRAtlasTileset& tileset = v_tilesets[i];
+		DefineTilesetImmediateCmd define;
+		define.tileset_index = (uint8_t)(first_tileset + i);
+		define.num_entries = (uint8_t)(tileset.entries.size() / 2);	// 0 means 256
+		define.xdim = tileset.xdim;
+		define.ydim = tileset.ydim;
+		define.asset_index = (uint8_t)(first_asset + tileset.atlas);
+		define.data = (uint8_t*)tileset.entries.data();
+		if (!batcher.Add(define))
+			return false;
+	}
+	return true;
+}
+
+static void PutU32BE(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back((uint8_t)(value >> 24));
+	out.push_back((uint8_t)(value >> 16));
+	out.push_back((uint8_t)(value >> 8));
+	out.push_back((uint8_t)value);
+}
+
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	static const std::array<uint32_t, 256> table = []() {
+		std::array<uint32_t, 256> t;
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			t[n] = c;
+		}
+		return t;
+	}();
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < length; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+// Appends a chunk, its length and CRC around the type and data
+static void PutChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+	PutU32BE(out, (uint32_t)data.size());
+	const size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PutU32BE(out, Crc32(out.data() + start, out.size() - start));
+}
+
+std::vector<uint8_t> SDHRAtlasBuilder::EncodePNG(const uint8_t* rgba, int width, int height)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<uint8_t> png(signature, signature + 8);
+
+	std::vector<uint8_t> header;
+	PutU32BE(header, (uint32_t)width);
+	PutU32BE(header, (uint32_t)height);
+	header.insert(header.end(), { 8, 6, 0, 0, 0 });	// 8 bits per channel, RGBA, deflate, no filter, not interlaced
+	PutChunk(png, "IHDR", header);
+
+	// each row is its filter type, none, and its pixels
+	const size_t row = (size_t)width * 4;
+	std::vector<uint8_t> raw;
+	raw.reserve((row + 1) * height);
+	for (int y = 0; y < height; y++)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), rgba + y * row, rgba + (y + 1) * row);
+	}
+
+	// zlib stream of stored deflate blocks
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	for (size_t done = 0; done < raw.size() || done == 0; )
+	{
+		const size_t block = std::min<size_t>(65535, raw.size() - done);
+		const bool last = (done + block == raw.size());
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back((uint8_t)block);
+		zlib.push_back((uint8_t)(block >> 8));
+		zlib.push_back((uint8_t)~block);
+		zlib.push_back((uint8_t)(~block >> 8));
+		zlib.insert(zlib.end(), raw.begin() + done, raw.begin() + done + block);
+		done += block;
+		if (last)
+			break;
+	}
+	// Adler-32, reduced every 5552 bytes, the most that can't overflow
+	uint32_t a = 1, b = 0;
+	for (size_t done = 0; done < raw.size(); done += 5552)
+	{
+		const size_t end = std::min<size_t>(done + 5552, raw.size());
+		for (size_t i = done; i < end; i++)
+		{
+			a += raw[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	PutU32BE(zlib, (b << 16) | a);
+	PutChunk(png, "IDAT", zlib);
+	PutChunk(png, "IEND", {});
+	return png;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "SDHRCommand.h"
+#include "SDHRUploadAllocator.h"
+#include <string>
+#include <vector>
+
+/**
+ * @brief SDHRAtlasBuilder
+ * Packs the tiles of any number of sprite sheets, of mixed tile sizes, into as few image assets as it can,
+ * and emits the assets along with the DefineTilesetImmediate records pointing into them.
+ * Each sheet becomes one tileset per 256 tiles. A tileset is packed as one block of its tiles,
+ * in their original order, with imstb_rectpack.
+ * Tileset entries address the asset in units of the tileset's own tile size, so each block sits on a
+ * multiple of every tile size in the atlas: mixing sizes that share few factors, like 12 and 16, wastes some space.
+ * With SetDedupe(), identical tiles of a tileset are packed once, and their entries share the cell.
+ * Once tile maps are passed to MarkUsed(), only the tiles they use are kept, identical ones once, and each
+ * tileset is renumbered from 0 without gaps: the maps then have to go through RemapMap() before they're sent.
+*/
+
+struct SDHRAtlasImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> rgba;
+};
+
+struct SDHRAtlasTileset
+{
+	size_t atlas = 0;					// which image it's packed in
+	uint8_t xdim = 0;
+	uint8_t ydim = 0;
+	std::vector<uint16_t> entries;		// x, y of each tile in the atlas, in tiles
+	uint8_t remap[256] = {};			// new tile index of each original one, when trimmed
+};
+
+struct SDHRAtlasStats
+{
+	size_t tiles = 0;			// in the sheets
+	size_t unused = 0;			// not in any map passed to MarkUsed()
+	size_t duplicates = 0;		// used, but identical to another
+	size_t cells = 0;			// tiles packed into the atlases
+	size_t entries = 0;			// in the tileset records
+};
+
+class SDHRAtlasBuilder
+{
+public:
+	SDHRAtlasBuilder(int max_width = 1024, int max_height = 1024) : max_width(max_width), max_height(max_height) {};
+
+	// Adds the tiles of a sheet, read left to right and top to bottom from a grid of xdim by ydim tiles.
+	// tile_count 0 takes all of them. Returns the number of the sheet's first tileset, or -1 if it has no tiles.
+	int AddSheet(const uint8_t* rgba, int width, int height, uint8_t xdim, uint8_t ydim, int tile_count = 0);
+	int AddSheetFile(const std::string& path, uint8_t xdim, uint8_t ydim, int tile_count = 0);
+
+	// Packs identical tiles of a tileset only once
+	void SetDedupe(bool enable) { dedupe = enable; packed = false; };
+
+	// Marks the tiles a tile map uses, as the UpdateWindowSetBoth data it is: a tileset and a tile index per tile.
+	// Tilesets are numbered as they'll be emitted, from first_tileset. Enables trimming for the next Pack().
+	void MarkUsed(const uint8_t* map, size_t tile_count, uint8_t first_tileset);
+	// Rewrites a map marked before the Pack() to the trimmed tile indexes. Returns false if it isn't trimmed.
+	bool RemapMap(uint8_t* map, size_t tile_count, uint8_t first_tileset) const;
+
+	// Packs everything added so far. Returns false if a tileset can't fit in an atlas on its own.
+	bool Pack();
+
+	// Uploads each atlas as a PNG in its own upload region, then defines it as asset first_asset onwards,
+	// and the tilesets as first_tileset onwards, in the order they were added.
+	// Returns false if it's not packed, or there aren't enough indexes or upload memory.
+	bool Emit(SDHRCommandBatcher& batcher, SDHRUploadAllocator& upload_memory, uint8_t first_asset, uint8_t first_tileset) const;
+
+	size_t GetAtlasCount() const { return v_atlases.size(); };
+	const SDHRAtlasImage& GetAtlas(size_t i) const { return v_atlases[i]; };
+	size_t GetTilesetCount() const { return v_tilesets.size(); };
+	const SDHRAtlasTileset& GetTileset(size_t i) const { return v_tilesets[i]; };
+	const SDHRAtlasStats& GetStats() const { return stats; };
+
+	// Encodes RGBA pixels as an uncompressed PNG, which AddUpload() compresses well for the trip
+	static std::vector<uint8_t> EncodePNG(const uint8_t* rgba, int width, int height);
+
+private:
+	// Tiles waiting to be packed, one tileset's worth
+	struct Source
+	{
+		SDHRAtlasImage tiles;			// one column of tiles
+		uint8_t xdim = 0;
+		uint8_t ydim = 0;
+		int tile_count = 0;
+		bool used[256] = {};
+	};
+
+	// Chooses the tiles of a source to pack: the cell of each tileset entry, and the source tile of each cell
+	void SelectTiles(const Source& source, SDHRAtlasTileset& tileset, std::vector<int>& v_entry_cells, std::vector<int>& v_cell_tiles);
+
+	int max_width;
+	int max_height;
+	std::vector<Source> v_sources;		// one per tileset
+	std::vector<SDHRAtlasImage> v_atlases;
+	std::vector<SDHRAtlasTileset> v_tilesets;
+	bool packed = false;
+	bool dedupe = false;
+	bool trim = false;					// set by MarkUsed()
+	SDHRAtlasStats stats;
+};
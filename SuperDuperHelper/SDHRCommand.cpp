@@ -1,186 +1,515 @@
 #include "SDHRCommand.h"
+#include "SDHRTrace.h"
+#include "SDHRResidencyCache.h"
+#include "SDHRUploadAllocator.h"
 #include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
 
 
 /* End SHDR Command Structures */
 
-void SDHRCommandBatcher::Publish()
+SDHRCommandBatcher::SDHRCommandBatcher(size_t initial_capacity)
 {
-	// TODO: Shouldn't have to recreate a vector
-	uint64_t vecsize = 0;
-	for (auto& cmd : v_cmds)
-	{
-		vecsize += cmd->v_data.size();
-	}
-	std::vector<uint8_t> v_fulldata;
-	v_fulldata.reserve(vecsize);
-	for (auto& cmd : v_cmds)
-	{
-		uint16_t cmd_size = cmd->v_data.size() - 1;
-		uint8_t* p_cmdsize = (uint8_t*)&cmd_size;
-		v_fulldata.insert(v_fulldata.end(), p_cmdsize, p_cmdsize + 2);
-		v_fulldata.insert(v_fulldata.end(), cmd->v_data.begin(), cmd->v_data.end());
-	}
-	GameLink::SDHR_write(v_fulldata);
-	GameLink::SendCommand(std::string(":sdhr_process"));
+	v_arena.resize(initial_capacity);
 }
 
-void SDHRCommandBatcher::AddCommand(SDHRCommand* command)
+std::future<SDHRPublishStats> SDHRCommandBatcher::Publish(int32_t target_frame)
 {
-	v_cmds.push_back(command);
+	if (drop_resident)
+		DropResident();
+	else
+		SDHRResidencyCache::Instance().Filter(v_arena.data(), arena_used, v_offsets, nullptr);
+	if (optimize)
+		Optimize();
+	if (compress)
+		Compress();
+	if (SDHRTraceRecorder::Instance().IsRecording())
+		SDHRTraceRecorder::Instance().Append(v_arena.data(), arena_used, v_offsets.size());
+	// before Submit(), so that a failure of this batch counts against the residency it records
+	for (const PendingResidency& pending : v_pending_residency)
+	{
+		const SDHRUploadRegion* region = pending.upload_memory->Find(pending.name);
+		if (region && region->first_page == pending.first_page)
+			pending.upload_memory->SetResident(pending.name, pending.content, pending.length);
+	}
+	v_pending_residency.clear();
+	return SDHRSender::Instance().Submit(v_arena.data(), arena_used, v_offsets, target_frame);
 }
 
-void SDHRCommand::InsertSizeHeader()
+void SDHRCommandBatcher::SetResidentOnPublish(SDHRUploadAllocator* upload_memory, const std::string& name, uint32_t first_page,
+	uint64_t content, size_t length)
 {
-	// OBSOLETE
-// 	uint16_t vSize = v_data.size() - 1;
-// 	uint8_t* p;
-// 	p = (uint8_t*)&vSize;
-// 	v_data.insert(v_data.begin(), p[1]);
-// 	v_data.insert(v_data.begin(), p[0]);
+	v_pending_residency.push_back({ upload_memory, name, first_page, content, length });
 }
 
-SDHRCommand_UpdateWindowEnable::SDHRCommand_UpdateWindowEnable(UpdateWindowEnableCmd* cmd)
+// Merges the tile region update at src into the one at out[last], which must be the last command in out,
+// if they target the same window and tileset, and their rectangles share a full edge.
+template <typename T>
+static bool MergeTileRegions(std::vector<uint8_t>& out, size_t last, const uint8_t* src)
 {
-	id = SDHR_CMD::UPDATE_WINDOW_ENABLE;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(UpdateWindowEnableCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
-}
+	using Layout = SDHRCommandLayout<T>;
+	constexpr size_t tile_bytes = (Layout::info.payload == SDHRPayload::TILES_2B) ? 2 : 1;
+	T a, b;
+	memcpy(&a, out.data() + last + 3, Layout::fixed_size);
+	memcpy(&b, src + 3, Layout::fixed_size);
+	if (a.window_index != b.window_index)
+		return false;
+	if constexpr (std::is_same_v<T, UpdateWindowSingleTilesetCmd>)
+	{
+		if (a.tileset_index != b.tileset_index)
+			return false;
+	}
+	const bool below = (a.tile_xbegin == b.tile_xbegin) && (a.tile_xcount == b.tile_xcount)
+		&& (b.tile_ybegin == a.tile_ybegin + (int64_t)a.tile_ycount);
+	const bool right = (a.tile_ybegin == b.tile_ybegin) && (a.tile_ycount == b.tile_ycount)
+		&& (b.tile_xbegin == a.tile_xbegin + (int64_t)a.tile_xcount);
+	if (!below && !right)
+		return false;
 
-SDHRCommand_DefineTilesetImmediate::SDHRCommand_DefineTilesetImmediate(DefineTilesetImmediateCmd* cmd)
-{
-	id = SDHR_CMD::DEFINE_TILESET_IMMEDIATE;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	// push all but the pointer to the data field
-	for (size_t i = 0; i < (sizeof(DefineTilesetImmediateCmd) - sizeof(uint8_t*)); i++) { v_data.push_back(p[i]); };
-	// push the data field
-	p = cmd->data;
-	size_t entries = (cmd->num_entries == 0) ? 256 : cmd->num_entries;
-	for (size_t i = 0; i < (size_t)4 * entries; i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
-}
+	const size_t a_payload = Layout::PayloadSize(a);
+	const size_t b_payload = Layout::PayloadSize(b);
+	const size_t merged_size = 1 + Layout::fixed_size + a_payload + b_payload;
+	if (2 + merged_size > GameLink::SDHR_GetMaxWriteLength())
+		return false;
 
-SDHRCommand_DefineWindow::SDHRCommand_DefineWindow(DefineWindowCmd* cmd)
-{
-	id = SDHR_CMD::DEFINE_WINDOW;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(DefineWindowCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	const uint8_t* b_data = src + 3 + Layout::fixed_size;
+	if (below)
+	{
+		// rows simply follow each other
+		out.insert(out.end(), b_data, b_data + b_payload);
+		a.tile_ycount += b.tile_ycount;
+	}
+	else
+	{
+		// each merged row is a row of a followed by the same row of b
+		const uint64_t rows = a.tile_ycount;
+		const size_t a_row = (size_t)a.tile_xcount * tile_bytes;
+		const size_t b_row = (size_t)b.tile_xcount * tile_bytes;
+		out.resize(out.size() + b_payload);
+		uint8_t* data = out.data() + last + 3 + Layout::fixed_size;
+		for (uint64_t row = rows; row-- > 0;)
+		{
+			memmove(data + row * (a_row + b_row), data + row * a_row, a_row);
+			memcpy(data + row * (a_row + b_row) + a_row, b_data + row * b_row, b_row);
+		}
+		a.tile_xcount += b.tile_xcount;
+	}
+	uint16_t size_header = (uint16_t)(merged_size - 1);
+	memcpy(out.data() + last, &size_header, 2);
+	memcpy(out.data() + last + 3, &a, Layout::fixed_size);
+	return true;
 }
 
-SDHRCommand_UpdateWindowSetBoth::SDHRCommand_UpdateWindowSetBoth(UpdateWindowSetBothCmd* cmd)
+SDHROptimizeStats SDHRCommandBatcher::Optimize()
 {
-	id = SDHR_CMD::UPDATE_WINDOW_SET_BOTH;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	// push all but the pointer to the data field
-	for (size_t i = 0; i < (sizeof(UpdateWindowSetBothCmd) - sizeof(uint8_t*)); i++) { v_data.push_back(p[i]); };
-	// push the data field
-	p = cmd->data;
-	for (size_t i = 0; i < (size_t)cmd->tile_xcount * cmd->tile_ycount * 2; i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
-}
+	SDHROptimizeStats stats;
+	const size_t count = v_offsets.size();
 
-SDHRCommand_UpdateWindowSetUpload::SDHRCommand_UpdateWindowSetUpload(UpdateWindowSetUploadCmd* cmd)
-{
-	id = SDHR_CMD::UPDATE_WINDOW_SET_UPLOAD;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(UpdateWindowSetUploadCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
-}
+	// Last write wins. Walking backwards, a view, position or enable update is dead
+	// if one of the same kind for the same window has already been seen.
+	std::vector<bool> v_dead(count, false);
+	bool seen[3][256] = {};
+	for (size_t i = count; i-- > 0;)
+	{
+		const uint8_t* cmd = v_arena.data() + v_offsets[i] + 2;
+		int kind;
+		switch ((SDHR_CMD)cmd[0])
+		{
+		case SDHR_CMD::UPDATE_WINDOW_ADJUST_WINDOW_VIEW:
+			kind = 0;
+			break;
+		case SDHR_CMD::UPDATE_WINDOW_SET_WINDOW_POSITION:
+			kind = 1;
+			break;
+		case SDHR_CMD::UPDATE_WINDOW_ENABLE:
+			kind = 2;
+			break;
+		default:
+			continue;
+		}
+		uint8_t window = cmd[1];
+		if (seen[kind][window])
+			v_dead[i] = true;
+		else
+			seen[kind][window] = true;
+	}
 
-SDHRCommand_UpdateWindowSetWindowPosition::SDHRCommand_UpdateWindowSetWindowPosition(UpdateWindowSetWindowPositionCmd* cmd) {
-	id = SDHR_CMD::UPDATE_WINDOW_SET_WINDOW_POSITION;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(UpdateWindowSetWindowPositionCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
-}
+	v_scratch.clear();
+	v_scratch.reserve(arena_used);
+	v_scratch_offsets.clear();
+	size_t last = SIZE_MAX;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (v_dead[i])
+		{
+			stats.commands_removed++;
+			continue;
+		}
+		const uint8_t* src = v_arena.data() + v_offsets[i];
+		const size_t length = ((i + 1 < count) ? v_offsets[i + 1] : arena_used) - v_offsets[i];
+		if (last != SIZE_MAX && src[2] == v_scratch[last + 2])
+		{
+			bool merged = false;
+			if (src[2] == (uint8_t)SDHR_CMD::UPDATE_WINDOW_SET_BOTH)
+				merged = MergeTileRegions<UpdateWindowSetBothCmd>(v_scratch, last, src);
+			else if (src[2] == (uint8_t)SDHR_CMD::UPDATE_WINDOW_SINGLE_TILESET)
+				merged = MergeTileRegions<UpdateWindowSingleTilesetCmd>(v_scratch, last, src);
+			if (merged)
+			{
+				stats.commands_removed++;
+				continue;
+			}
+		}
+		last = v_scratch.size();
+		v_scratch_offsets.push_back((uint32_t)last);
+		v_scratch.insert(v_scratch.end(), src, src + length);
+	}
 
-SDHRCommand_UploadData::SDHRCommand_UploadData(UploadDataCmd* cmd)
-{
-	id = SDHR_CMD::UPLOAD_DATA;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(UploadDataCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	stats.bytes_saved = arena_used - v_scratch.size();
+	arena_used = v_scratch.size();
+	v_arena.swap(v_scratch);
+	v_offsets.swap(v_scratch_offsets);
+	last_optimize = stats;
+	return stats;
 }
 
-SDHRCommand_UploadDataFilename::SDHRCommand_UploadDataFilename(UploadDataFilenameCmd* cmd)
+SDHRResidencyStats SDHRCommandBatcher::DropResident()
 {
-	id = SDHR_CMD::UPLOAD_DATA_FILENAME;
-	v_data.push_back((uint8_t)id);
-	v_data.push_back(cmd->dest_addr_med);
-	v_data.push_back(cmd->dest_addr_high);
-	v_data.push_back(cmd->filename_length);
-	// push the filename string (no trailing null)
-	for (size_t i = 0; i < cmd->filename_length; i++) { v_data.push_back(cmd->filename[i]); };
-	InsertSizeHeader();
+	SDHRResidencyStats stats;
+	const size_t count = v_offsets.size();
+	SDHRResidencyCache::Instance().Filter(v_arena.data(), arena_used, v_offsets, &v_keep);
+
+	v_scratch.clear();
+	v_scratch.reserve(arena_used);
+	v_scratch_offsets.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint8_t* src = v_arena.data() + v_offsets[i];
+		const size_t length = ((i + 1 < count) ? v_offsets[i + 1] : arena_used) - v_offsets[i];
+		if (!v_keep[i])
+		{
+			stats.commands_dropped++;
+			stats.bytes_dropped += length;
+			continue;
+		}
+		v_scratch_offsets.push_back((uint32_t)v_scratch.size());
+		v_scratch.insert(v_scratch.end(), src, src + length);
+	}
+
+	arena_used = v_scratch.size();
+	v_arena.swap(v_scratch);
+	v_offsets.swap(v_scratch_offsets);
+	last_residency = stats;
+	return stats;
 }
 
-SDHRCommand_DefineImageAsset::SDHRCommand_DefineImageAsset(DefineImageAssetCmd* cmd)
+const SDHRCompressStats& SDHRCommandBatcher::Compress()
 {
-	id = SDHR_CMD::DEFINE_IMAGE_ASSET;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(DefineImageAssetCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	// payloads this small don't gain enough to pay for the decompression
+	constexpr size_t MIN_PAYLOAD = 64;
+	using RawLayout = SDHRCommandLayout<UpdateWindowSetBothCmd>;
+	using CompressedLayout = SDHRCommandLayout<UpdateWindowSetBothCompressedCmd>;
+
+	const size_t count = v_offsets.size();
+	v_scratch.clear();
+	v_scratch.reserve(arena_used);
+	v_scratch_offsets.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint8_t* src = v_arena.data() + v_offsets[i];
+		const size_t length = ((i + 1 < count) ? v_offsets[i + 1] : arena_used) - v_offsets[i];
+		v_scratch_offsets.push_back((uint32_t)v_scratch.size());
+		const size_t payload = length - 3 - RawLayout::fixed_size;
+		if (src[2] != (uint8_t)SDHR_CMD::UPDATE_WINDOW_SET_BOTH || payload < MIN_PAYLOAD)
+		{
+			v_scratch.insert(v_scratch.end(), src, src + length);
+			continue;
+		}
+
+		const uint8_t* tiles = src + 3 + RawLayout::fixed_size;
+		SDHR_CODEC codec = SDHRCompress::CompressBest(tiles, payload, v_compressed);
+		compress_stats.raw_bytes += payload;
+		if (v_compressed.size() * compress_min_ratio > payload)
+		{
+			compress_stats.payloads_raw++;
+			compress_stats.encoded_bytes += payload;
+			v_scratch.insert(v_scratch.end(), src, src + length);
+			continue;
+		}
+		compress_stats.payloads_compressed++;
+		compress_stats.encoded_bytes += v_compressed.size();
+
+		UpdateWindowSetBothCmd raw;
+		memcpy(&raw, src + 3, RawLayout::fixed_size);
+		UpdateWindowSetBothCompressedCmd cmd;
+		cmd.window_index = raw.window_index;
+		cmd.tile_xbegin = raw.tile_xbegin;
+		cmd.tile_ybegin = raw.tile_ybegin;
+		cmd.tile_xcount = raw.tile_xcount;
+		cmd.tile_ycount = raw.tile_ycount;
+		cmd.codec = (uint8_t)codec;
+		cmd.data_length = (uint16_t)v_compressed.size();
+		cmd.data = v_compressed.data();
+		const size_t cmd_size = CompressedLayout::Size(cmd);
+		const size_t out = v_scratch.size();
+		v_scratch.resize(out + 2 + cmd_size);
+		uint16_t size_header = (uint16_t)(cmd_size - 1);
+		memcpy(v_scratch.data() + out, &size_header, 2);
+		CompressedLayout::Encode(cmd, v_scratch.data() + out + 2);
+	}
+
+	arena_used = v_scratch.size();
+	v_arena.swap(v_scratch);
+	v_offsets.swap(v_scratch_offsets);
+	return compress_stats;
 }
 
-SDHRCommand_DefineImageAssetFilename::SDHRCommand_DefineImageAssetFilename(DefineImageAssetFilenameCmd* cmd)
+bool SDHRCommandBatcher::AddUpload(uint32_t dest_addr, const uint8_t* data, size_t length)
 {
-	id = SDHR_CMD::DEFINE_IMAGE_ASSET_FILENAME;
-	v_data.push_back((uint8_t)id);
-	v_data.push_back(cmd->asset_index);
-	v_data.push_back(cmd->filename_length);
-	// push the filename string (no trailing null)
-	for (size_t i = 0; i < cmd->filename_length; i++) { v_data.push_back(cmd->filename[i]); };
-	InsertSizeHeader();
+	// 128 pages per command keeps even incompressible data well within one SHM write
+	constexpr size_t MAX_PIECE = 32768;
+	if (dest_addr & 0xFF)
+	{
+		OutputDebugStringW(L"ERROR: SDHR upload destination must be a multiple of 256!\n");
+		return false;
+	}
+	for (size_t done = 0; done < length; done += MAX_PIECE)
+	{
+		const size_t piece = std::min(MAX_PIECE, length - done);
+		const uint32_t dest = dest_addr + (uint32_t)done;
+		UploadDataCompressedCmd cmd;
+		cmd.dest_addr_med = (uint8_t)(dest >> 8);
+		cmd.dest_addr_high = (uint8_t)(dest >> 16);
+		cmd.decompressed_length = (uint32_t)piece;
+
+		SDHR_CODEC codec = SDHRCompress::CompressBest(data + done, piece, v_compressed);
+		compress_stats.raw_bytes += piece;
+		if (v_compressed.size() * compress_min_ratio > piece)
+		{
+			compress_stats.payloads_raw++;
+			compress_stats.encoded_bytes += piece;
+			cmd.codec = (uint8_t)SDHR_CODEC::RAW;
+			cmd.data_length = (uint16_t)piece;
+			cmd.data = const_cast<uint8_t*>(data + done);
+		}
+		else
+		{
+			compress_stats.payloads_compressed++;
+			compress_stats.encoded_bytes += v_compressed.size();
+			cmd.codec = (uint8_t)codec;
+			cmd.data_length = (uint16_t)v_compressed.size();
+			cmd.data = v_compressed.data();
+		}
+		if (!Add(cmd))
+			return false;
+	}
+	return true;
 }
 
+// Wire cost of a command's size header, id byte and fixed header
+template <typename T>
+constexpr size_t CommandHeaderSize = 2 + 1 + SDHRCommandLayout<T>::fixed_size;
 
-SDHRCommand_DefineTileset::SDHRCommand_DefineTileset(DefineTilesetCmd* cmd)
+SDHRSetTilesStats SDHRCommandBatcher::SetTiles(int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin, uint64_t tile_xcount, uint64_t tile_ycount,
+	const uint8_t* tiles, SDHRUploadAllocator* upload_memory, const std::string& upload_name)
 {
-	id = SDHR_CMD::DEFINE_TILESET;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(DefineTilesetCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	// payloads smaller than this aren't worth looking at for an upload
+	constexpr size_t MIN_UPLOAD = 4096;
+	constexpr size_t SET_BOTH_HEADER = CommandHeaderSize<UpdateWindowSetBothCmd>;
+	constexpr size_t SINGLE_TILESET_HEADER = CommandHeaderSize<UpdateWindowSingleTilesetCmd>;
+	constexpr size_t SET_UPLOAD_HEADER = CommandHeaderSize<UpdateWindowSetUploadCmd>;
+	constexpr size_t UPLOAD_HEADER = CommandHeaderSize<UploadDataCompressedCmd>;
+
+	SDHRSetTilesStats stats;
+	const size_t start_size = arena_used;
+	const size_t row_bytes = (size_t)tile_xcount * 2;
+	const size_t tile_bytes = row_bytes * tile_ycount;
+	stats.set_both_bytes = SET_BOTH_HEADER + tile_bytes;
+	if (tile_bytes == 0)
+	{
+		stats.ok = true;
+		return stats;
+	}
+
+	// tileset of each row, or -1 if it has several
+	std::vector<int>& v_row_tileset = v_row_tilesets;
+	v_row_tileset.assign(tile_ycount, -1);
+	for (uint64_t y = 0; y < tile_ycount; y++)
+	{
+		const uint8_t* row = tiles + y * row_bytes;
+		int tileset = row[0];
+		for (uint64_t x = 1; x < tile_xcount && tileset >= 0; x++)
+			if (row[x * 2] != row[0])
+				tileset = -1;
+		v_row_tileset[y] = tileset;
+	}
+
+	// Cheapest split into bands of rows, going down one row at a time. The last band so far is either
+	// a SetBoth band, that takes any row, or a SingleTileset band, that takes rows of its tileset only.
+	// Either the row extends the last band, if it can, or starts a new one after the cheapest split so far.
+	std::vector<TileStep>& v_steps = v_tile_steps;
+	v_steps.assign(tile_ycount, TileStep());
+	for (uint64_t y = 0; y < tile_ycount; y++)
+	{
+		TileStep& step = v_steps[y];
+		const size_t before = y ? v_steps[y - 1].Best() : 0;
+		step.set_both = before + SET_BOTH_HEADER;
+		if (y && v_steps[y - 1].set_both < step.set_both)
+		{
+			step.set_both = v_steps[y - 1].set_both;
+			step.set_both_extends = true;
+		}
+		step.set_both += row_bytes;
+		if (v_row_tileset[y] >= 0)
+		{
+			step.single = before + SINGLE_TILESET_HEADER;
+			if (y && v_row_tileset[y - 1] == v_row_tileset[y] && v_steps[y - 1].single < step.single)
+			{
+				step.single = v_steps[y - 1].single;
+				step.single_extends = true;
+			}
+			step.single += tile_xcount;
+		}
+	}
+	const size_t direct_cost = v_steps[tile_ycount - 1].Best();
+
+	// an upload is only worth it when it's already there, or large enough to compress well
+	const SDHRUploadRegion* region = nullptr;
+	size_t upload_cost = SIZE_MAX;
+	const uint64_t content = SDHRHash(tiles, tile_bytes);
+	if (upload_memory != nullptr)
+	{
+		const SDHRUploadRegion* existing = upload_memory->Find(upload_name);
+		if (existing && upload_memory->IsResident(upload_name, content, tile_bytes))
+		{
+			region = existing;
+			upload_cost = SET_UPLOAD_HEADER;
+		}
+		else if (tile_bytes >= MIN_UPLOAD)
+		{
+			SDHRCompress::CompressBest(tiles, tile_bytes, v_compressed);
+			const size_t pieces = (tile_bytes + 32767) / 32768;
+			upload_cost = SET_UPLOAD_HEADER + pieces * UPLOAD_HEADER + std::min(tile_bytes, v_compressed.size());
+		}
+	}
+
+	if (upload_cost < direct_cost)
+	{
+		if (region == nullptr)
+			region = upload_memory->Upload(*this, upload_name, tiles, tile_bytes);
+		if (region == nullptr)
+			return stats;
+		UpdateWindowSetUploadCmd cmd;
+		cmd.window_index = window_index;
+		cmd.tile_xbegin = tile_xbegin;
+		cmd.tile_ybegin = tile_ybegin;
+		cmd.tile_xcount = tile_xcount;
+		cmd.tile_ycount = tile_ycount;
+		cmd.upload_addr_med = region->AddrMed();
+		cmd.upload_addr_high = region->AddrHigh();
+		if (!Add(cmd))
+			return stats;
+		stats.set_upload_commands++;
+	}
+	else
+	{
+		// bands come out last to first, so they're collected before being added in order
+		std::vector<TileBand>& v_bands = v_tile_bands;
+		v_bands.clear();
+		uint64_t end = tile_ycount;
+		bool single = v_steps[end - 1].single < v_steps[end - 1].set_both;
+		while (end > 0)
+		{
+			uint64_t begin = end - 1;
+			while (single ? v_steps[begin].single_extends : v_steps[begin].set_both_extends)
+				begin--;
+			v_bands.push_back({ begin, end, single });
+			end = begin;
+			if (end > 0)
+				single = v_steps[end - 1].single < v_steps[end - 1].set_both;
+		}
+		std::vector<uint8_t>& v_indexes = v_tile_indexes;
+		for (auto band = v_bands.rbegin(); band != v_bands.rend(); ++band)
+		{
+			const uint64_t begin = band->begin;
+			const uint64_t rows = band->end - begin;
+			bool added;
+			if (band->single)
+			{
+				v_indexes.resize((size_t)(rows * tile_xcount));
+				const uint8_t* src = tiles + begin * row_bytes;
+				for (size_t i = 0; i < v_indexes.size(); i++)
+					v_indexes[i] = src[i * 2 + 1];
+				UpdateWindowSingleTilesetCmd cmd;
+				cmd.window_index = window_index;
+				cmd.tile_xbegin = tile_xbegin;
+				cmd.tile_ybegin = tile_ybegin + (int64_t)begin;
+				cmd.tile_xcount = tile_xcount;
+				cmd.tile_ycount = rows;
+				cmd.tileset_index = (uint8_t)v_row_tileset[begin];
+				cmd.data = v_indexes.data();
+				added = Add(cmd);
+				stats.single_tileset_commands++;
+			}
+			else
+			{
+				UpdateWindowSetBothCmd cmd;
+				cmd.window_index = window_index;
+				cmd.tile_xbegin = tile_xbegin;
+				cmd.tile_ybegin = tile_ybegin + (int64_t)begin;
+				cmd.tile_xcount = tile_xcount;
+				cmd.tile_ycount = rows;
+				cmd.data = const_cast<uint8_t*>(tiles + begin * row_bytes);
+				added = Add(cmd);
+				stats.set_both_commands++;
+			}
+			if (!added)
+				return stats;
+		}
+	}
+	stats.bytes = arena_used - start_size;
+	stats.ok = true;
+	return stats;
 }
 
+bool SDHRCommandBatcher::AddCommand(const SDHRCommand* command)
+{
+	return command->AddTo(*this);
+}
 
-SDHRCommand_UpdateWindowSingleTileset::SDHRCommand_UpdateWindowSingleTileset(UpdateWindowSingleTilesetCmd* cmd)
+void SDHRCommandBatcher::Clear()
 {
-	id = SDHR_CMD::UPDATE_WINDOW_SINGLE_TILESET;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	// push all but the pointer to the data field
-	for (size_t i = 0; i < (sizeof(UpdateWindowSingleTilesetCmd) - sizeof(uint8_t*)); i++) { v_data.push_back(p[i]); };
-	// push the data field
-	p = cmd->data;
-	for (size_t i = 0; i < (size_t)cmd->tile_xcount * cmd->tile_ycount; i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	arena_used = 0;
+	v_offsets.clear();
+	compress_stats = SDHRCompressStats();
+	v_pending_residency.clear();
 }
 
-SDHRCommand_UpdateWindowShiftTiles::SDHRCommand_UpdateWindowShiftTiles(UpdateWindowShiftTilesCmd* cmd)
+uint8_t* SDHRCommandBatcher::BeginCommand(size_t cmd_size)
 {
-	id = SDHR_CMD::UPDATE_WINDOW_SHIFT_TILES;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(UpdateWindowShiftTilesCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	// the size header doesn't count the id byte, and is only 16 bits
+	if (cmd_size - 1 > UINT16_MAX)
+	{
+		OutputDebugStringW(L"ERROR: SDHR command is too large to be encoded!\n");
+		return nullptr;
+	}
+	v_offsets.push_back((uint32_t)arena_used);
+	uint8_t* p = Reserve(2 + cmd_size);
+	uint16_t size_header = (uint16_t)(cmd_size - 1);
+	memcpy(p, &size_header, 2);
+	return p + 2;
 }
 
-SDHRCommand_UpdateWindowAdjustWindowView::SDHRCommand_UpdateWindowAdjustWindowView(UpdateWindowAdjustWindowViewCmd* cmd)
+uint8_t* SDHRCommandBatcher::Reserve(size_t count)
 {
-	id = SDHR_CMD::UPDATE_WINDOW_ADJUST_WINDOW_VIEW;
-	v_data.push_back((uint8_t)id);
-	uint8_t* p = (uint8_t*)cmd;
-	for (size_t i = 0; i < sizeof(UpdateWindowAdjustWindowViewCmd); i++) { v_data.push_back(p[i]); };
-	InsertSizeHeader();
+	if (arena_used + count > v_arena.size())
+	{
+		// grow geometrically so that adding commands stays amortized constant time
+		v_arena.resize(std::max(arena_used + count, v_arena.size() * 2));
+	}
+	uint8_t* p = v_arena.data() + arena_used;
+	arena_used += count;
+	return p;
 }
@@ -1,28 +1,217 @@
 #pragma once
 #include "GameLink.h"
+#include "SDHRSender.h"
+#include "SDHRCompress.h"
+#include <string>
 #include <vector>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
 
 class SDHRCommand;	// forward declaration
+class SDHRUploadAllocator;
+
+/**
+ * @brief SDHROptimizeStats
+ * What SDHRCommandBatcher::Optimize() took out of a batch
+*/
+struct SDHROptimizeStats
+{
+	size_t commands_removed = 0;	// superseded commands dropped, plus tile updates merged into their neighbor
+	size_t bytes_saved = 0;
+};
+
+/**
+ * @brief SDHRResidencyStats
+ * Commands DropResident() found already resident in the emulator
+*/
+struct SDHRResidencyStats
+{
+	size_t commands_dropped = 0;
+	size_t bytes_dropped = 0;
+};
+
+/**
+ * @brief SDHRSetTilesStats
+ * How SetTiles() encoded a tile region
+*/
+struct SDHRSetTilesStats
+{
+	bool ok = false;
+	size_t set_both_commands = 0;
+	size_t single_tileset_commands = 0;
+	size_t set_upload_commands = 0;
+	size_t bytes = 0;				// added to the batch, uploads included
+	size_t set_both_bytes = 0;		// what one UpdateWindowSetBoth of the region would have cost
+};
+
+/**
+ * @brief SDHRCompressStats
+ * Payloads the batcher considered for compression since the last Clear()
+*/
+struct SDHRCompressStats
+{
+	size_t payloads_compressed = 0;
+	size_t payloads_raw = 0;		// not worth compressing, sent as is
+	size_t raw_bytes = 0;			// payload bytes before compression
+	size_t encoded_bytes = 0;		// the same payloads as sent
+
+	double Ratio() const { return (encoded_bytes > 0) ? ((double)raw_bytes / encoded_bytes) : 1.0; };
+};
 
 /**
  * @brief SDHRCommandBatcher
+ * Encodes each added command straight into one contiguous arena, size header included,
+ * so publishing is a single copy into SHM. The arena is kept across Clear() and reused.
  * Writes the complete command batch to SHM along with a SDHR_CMD_READY flag
- * Call GameLink::SDHR_process() to have AppleWin process them
+ * Batches larger than what SHM holds are sent as several chunks split at command boundaries,
+ * each written and processed in turn. Tile region updates too large for one chunk are split
+ * into smaller regions when they're added.
+ * Publishing hands a copy of the batch to the SDHRSender thread, so it never blocks the caller.
+ * With SetOptimize(true), every Publish() first runs Optimize() on the batch.
+ * With SetCompress(true), every Publish() then runs Compress() on the batch.
+ * While SDHRTraceRecorder is recording, every published batch is also appended to the trace.
 */
 class SDHRCommandBatcher
 {
 public:
-
-	// Publishes the queued commands.
-	// Call GameLink::SDHR_process() to have AppleWin process them
-	void Publish();
+	SDHRCommandBatcher(size_t initial_capacity = 0);
+
+	// Queues the commands to be published, and processed by AppleWin, on the SDHRSender thread
+	// The batch itself is left as is, so it can be published again or cleared.
+	// The future completes with the outcome once the batch has been sent.
+	// In SDHRSender frame sync mode, the batch is released on target_frame, see SDHRSender::Submit().
+	std::future<SDHRPublishStats> Publish(int32_t target_frame = SDHRSender::NEXT_FRAME);
+
+	// Peephole pass over the encoded batch, which can only make it smaller:
+	// - view, position and enable updates are dropped when a later one of the same kind targets the same window
+	// - consecutive SetBoth or SingleTileset updates of the same window that cover adjacent rectangles
+	//   sharing a full edge are merged into one update
+	SDHROptimizeStats Optimize();
+
+	// Runs Optimize() as part of every Publish()
+	void SetOptimize(bool enable) { optimize = enable; };
+	const SDHROptimizeStats& GetLastOptimizeStats() const { return last_optimize; };
+
+	// Drops the uploads, asset and tileset definitions that would only put back what the emulator
+	// already holds, as known to SDHRResidencyCache, and records the others as resident.
+	SDHRResidencyStats DropResident();
+
+	// Runs DropResident() as part of every Publish(), before Optimize()
+	void SetDropResident(bool enable) { drop_resident = enable; };
+	const SDHRResidencyStats& GetLastResidencyStats() const { return last_residency; };
+
+	// Replaces each UpdateWindowSetBoth whose tiles compress by at least the min_ratio given to SetCompress()
+	// with the equivalent UpdateWindowSetBothCompressed. Other commands are left alone.
+	const SDHRCompressStats& Compress();
+
+	// Runs Compress() as part of every Publish(). min_ratio is the uncompressed over compressed size
+	// a payload has to reach to be sent compressed, as decompressing isn't free on the other side.
+	void SetCompress(bool enable, double min_ratio = 1.5) { compress = enable; compress_min_ratio = min_ratio; };
+	const SDHRCompressStats& GetCompressStats() const { return compress_stats; };
+
+	// Adds length bytes of data to be written at dest_addr in upload memory, carried inline in the batch.
+	// It goes as UploadDataCompressed commands of at most 32 KB of data each, compressed when that
+	// reaches the SetCompress() min_ratio, whether Compress() is enabled or not.
+	// dest_addr must be a multiple of 256. Returns false if it isn't, or a command can't be encoded.
+	bool AddUpload(uint32_t dest_addr, const uint8_t* data, size_t length);
+	// Has the next Publish() mark the named region of upload_memory resident with content,
+	// as SDHRUploadAllocator::SetResident() does, if the region is still at first_page by then.
+	// Nothing is marked if the batch is cleared without being published. upload_memory must outlive the batch.
+	void SetResidentOnPublish(SDHRUploadAllocator* upload_memory, const std::string& name, uint32_t first_page,
+		uint64_t content, size_t length);
+
+	// Sets a region of a window's tiles, given 2 bytes per tile (tileset, index) row-major,
+	// with whichever encoding costs the fewest bytes, before any Compress():
+	// - UpdateWindowSingleTileset for bands of rows that use one tileset, which skips the tileset bytes
+	// - UpdateWindowSetBoth for the rest
+	// - with upload_memory, UpdateWindowSetUpload from a region named upload_name,
+	//   that costs only its header when the region already holds the tiles, and otherwise their upload, compressed
+	SDHRSetTilesStats SetTiles(int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin, uint64_t tile_xcount, uint64_t tile_ycount,
+		const uint8_t* tiles, SDHRUploadAllocator* upload_memory = nullptr, const std::string& upload_name = std::string());
 
 	// Stream of subcommands to add to the command
 	// They'll be processed in FIFO.
-	void AddCommand(SDHRCommand* command);
+	// The command is encoded immediately, so its source buffers can be reused as soon as this returns
+	// Returns false if the command is too large to be encoded
+	bool AddCommand(const SDHRCommand* command);
+
+	// Encodes a command struct directly, without going through a SDHRCommand object.
+	// The layout comes from SDHRCommandTable, so fixed-size commands are a single copy of known size.
+	template <typename T>
+	bool Add(const T& cmd);
+
+	// Empties the batch, keeping the arena allocated for the next one
+	void Clear();
+
+	const uint8_t* Data() const { return v_arena.data(); };
+	size_t Size() const { return arena_used; };
+	size_t CommandCount() const { return v_offsets.size(); };
+	// Offset of each command's size header in Data()
+	const std::vector<uint32_t>& Offsets() const { return v_offsets; };
 
 private:
-	std::vector<SDHRCommand*> v_cmds;
+	// Adds a tile region update that doesn't fit in one SHM write as several smaller regions:
+	// bands of whole rows, or runs within a row if a single row is already too large
+	template <typename T>
+	bool AddSplit(const T& cmd);
+
+	// Writes the size header for a command of cmd_size bytes (id byte included),
+	// and returns where the id byte goes. Returns nullptr if the command is too large.
+	uint8_t* BeginCommand(size_t cmd_size);
+
+	// Grows the arena if needed and returns a pointer to count bytes at its end
+	uint8_t* Reserve(size_t count);
+
+	std::vector<uint8_t> v_arena;
+	size_t arena_used = 0;
+	std::vector<uint32_t> v_offsets;	// arena offset of each command's size header
+
+	bool optimize = false;
+	SDHROptimizeStats last_optimize;
+	std::vector<uint8_t> v_scratch;		// Optimize() output, swapped with the arena
+	std::vector<uint32_t> v_scratch_offsets;
+
+	bool drop_resident = false;
+	SDHRResidencyStats last_residency;
+	std::vector<bool> v_keep;
+
+	bool compress = false;
+	double compress_min_ratio = 1.5;
+	SDHRCompressStats compress_stats;
+	std::vector<uint8_t> v_compressed;
+
+	// Regions whose uploads are in the batch, made resident when it's published
+	struct PendingResidency
+	{
+		SDHRUploadAllocator* upload_memory;
+		std::string name;
+		uint32_t first_page;
+		uint64_t content;
+		size_t length;
+	};
+	std::vector<PendingResidency> v_pending_residency;
+
+	// SetTiles() scratch, kept between calls like the others
+	// Cheapest split into bands up to a row: ending in a SetBoth band, or in a SingleTileset band
+	struct TileStep
+	{
+		size_t set_both = SIZE_MAX;
+		size_t single = SIZE_MAX;
+		bool set_both_extends = false;	// the row extends the SetBoth band of the row above
+		bool single_extends = false;
+		size_t Best() const { return std::min(set_both, single); };
+	};
+	// Rows [begin, end) in one command
+	struct TileBand
+	{
+		uint64_t begin, end;
+		bool single;
+	};
+	std::vector<int> v_row_tilesets;	// tileset of each row, or -1 if it has several
+	std::vector<TileStep> v_tile_steps;
+	std::vector<TileBand> v_tile_bands;
+	std::vector<uint8_t> v_tile_indexes;	// SingleTileset payload
 };
 
 /**
@@ -146,103 +335,289 @@ struct UpdateWindowEnableCmd {
 	bool enabled;
 };
 
+struct UploadDataCompressedCmd {
+	uint8_t dest_addr_med;
+	uint8_t dest_addr_high;
+	uint32_t decompressed_length;	// bytes written to upload memory
+	uint8_t codec;					// SDHR_CODEC
+	uint16_t data_length;
+	uint8_t* data;  // data_length bytes, decoded with SDHRDecompress()
+};
+
+struct UpdateWindowSetBothCompressedCmd {
+	int8_t window_index;
+	int64_t tile_xbegin;
+	int64_t tile_ybegin;
+	uint64_t tile_xcount;
+	uint64_t tile_ycount;
+	uint8_t codec;					// SDHR_CODEC
+	uint16_t data_length;
+	uint8_t* data;  // data_length bytes, decoding to the 2-byte records per tile of UpdateWindowSetBoth
+};
+
 #pragma pack(pop)
 
 /**
- * @brief SDHRCommand
- * Superclass of all SDHR commands
- * Each SDHR command will be constructed with all necessary data
- * It makes a copy of the data so you can reuse your buffers when creating commands
+ * @brief SDHR command table
+ * One entry per SDHR_CMD, indexed by its value. Describes how each command looks on the wire:
+ * the fixed header (the command struct minus its trailing pointer, if any),
+ * and the rule that sizes the variable payload following it.
+ * The encoder below is generated from this table.
 */
-class SDHRCommand
-{
-public:
-	SDHR_CMD id = SDHR_CMD::NONE;
-	std::vector<uint8_t> v_data;
-protected:
-	void InsertSizeHeader();
+enum class SDHRPayload : uint8_t {
+	NONE,				// fixed header only
+	FILENAME,			// 1 byte per character, count is the uint8_t filename_length
+	TILESET_ENTRIES,	// 4 bytes per entry, count is the uint8_t num_entries (0 means 256)
+	TILES_1B,			// 1 byte per tile, count is the uint64_t tile_xcount times the uint64_t tile_ycount after it
+	TILES_2B,			// 2 bytes per tile, counted as above
+	DATA_LENGTH,		// compressed bytes, count is the uint16_t data_length
+	UNKNOWN,			// layout not confirmed yet: there's no struct to encode it, and it doesn't decode
 };
 
-class SDHRCommand_UploadData : public SDHRCommand
-{
-public:
-	SDHRCommand_UploadData(UploadDataCmd* cmd);
+struct SDHRCommandInfo {
+	SDHR_CMD id;
+	const char* name;
+	uint16_t fixed_size;	// bytes after the id byte, before the payload
+	SDHRPayload payload;
+	uint16_t count_offset;	// offset in the fixed header of the payload's count field
 };
 
-class SDHRCommand_UploadDataFilename : public SDHRCommand
-{
-public:
-	SDHRCommand_UploadDataFilename(UploadDataFilenameCmd* cmd);
+constexpr SDHRCommandInfo SDHRCommandTable[] = {
+	{ SDHR_CMD::NONE, "NONE", 0, SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPLOAD_DATA, "UPLOAD_DATA", sizeof(UploadDataCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::DEFINE_IMAGE_ASSET, "DEFINE_IMAGE_ASSET", sizeof(DefineImageAssetCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::DEFINE_IMAGE_ASSET_FILENAME, "DEFINE_IMAGE_ASSET_FILENAME", offsetof(DefineImageAssetFilenameCmd, filename),
+		SDHRPayload::FILENAME, offsetof(DefineImageAssetFilenameCmd, filename_length) },
+	{ SDHR_CMD::DEFINE_TILESET, "DEFINE_TILESET", sizeof(DefineTilesetCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::DEFINE_TILESET_IMMEDIATE, "DEFINE_TILESET_IMMEDIATE", offsetof(DefineTilesetImmediateCmd, data),
+		SDHRPayload::TILESET_ENTRIES, offsetof(DefineTilesetImmediateCmd, num_entries) },
+	{ SDHR_CMD::DEFINE_WINDOW, "DEFINE_WINDOW", sizeof(DefineWindowCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPDATE_WINDOW_SET_BOTH, "UPDATE_WINDOW_SET_BOTH", offsetof(UpdateWindowSetBothCmd, data),
+		SDHRPayload::TILES_2B, offsetof(UpdateWindowSetBothCmd, tile_xcount) },
+	{ SDHR_CMD::UPDATE_WINDOW_SINGLE_TILESET, "UPDATE_WINDOW_SINGLE_TILESET", offsetof(UpdateWindowSingleTilesetCmd, data),
+		SDHRPayload::TILES_1B, offsetof(UpdateWindowSingleTilesetCmd, tile_xcount) },
+	{ SDHR_CMD::UPDATE_WINDOW_SHIFT_TILES, "UPDATE_WINDOW_SHIFT_TILES", sizeof(UpdateWindowShiftTilesCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPDATE_WINDOW_SET_WINDOW_POSITION, "UPDATE_WINDOW_SET_WINDOW_POSITION", sizeof(UpdateWindowSetWindowPositionCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPDATE_WINDOW_ADJUST_WINDOW_VIEW, "UPDATE_WINDOW_ADJUST_WINDOW_VIEW", sizeof(UpdateWindowAdjustWindowViewCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPDATE_WINDOW_SET_BITMASKS, "UPDATE_WINDOW_SET_BITMASKS", 0, SDHRPayload::UNKNOWN, 0 },
+	{ SDHR_CMD::UPDATE_WINDOW_ENABLE, "UPDATE_WINDOW_ENABLE", sizeof(UpdateWindowEnableCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::READY, "READY", 0, SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPLOAD_DATA_FILENAME, "UPLOAD_DATA_FILENAME", offsetof(UploadDataFilenameCmd, filename),
+		SDHRPayload::FILENAME, offsetof(UploadDataFilenameCmd, filename_length) },
+	{ SDHR_CMD::UPDATE_WINDOW_SET_UPLOAD, "UPDATE_WINDOW_SET_UPLOAD", sizeof(UpdateWindowSetUploadCmd), SDHRPayload::NONE, 0 },
+	{ SDHR_CMD::UPLOAD_DATA_COMPRESSED, "UPLOAD_DATA_COMPRESSED", offsetof(UploadDataCompressedCmd, data),
+		SDHRPayload::DATA_LENGTH, offsetof(UploadDataCompressedCmd, data_length) },
+	{ SDHR_CMD::UPDATE_WINDOW_SET_BOTH_COMPRESSED, "UPDATE_WINDOW_SET_BOTH_COMPRESSED", offsetof(UpdateWindowSetBothCompressedCmd, data),
+		SDHRPayload::DATA_LENGTH, offsetof(UpdateWindowSetBothCompressedCmd, data_length) },
 };
 
-class SDHRCommand_DefineImageAsset : public SDHRCommand
-{
-public:
-	SDHRCommand_DefineImageAsset(DefineImageAssetCmd* cmd);
-};
+constexpr size_t SDHR_CMD_COUNT = sizeof(SDHRCommandTable) / sizeof(SDHRCommandTable[0]);
 
-class SDHRCommand_DefineImageAssetFilename : public SDHRCommand
+constexpr bool SDHRCommandTableIsIndexedById()
 {
-public:
-	SDHRCommand_DefineImageAssetFilename(DefineImageAssetFilenameCmd* cmd);
-};
-
-class SDHRCommand_DefineTileset : public SDHRCommand
+	for (size_t i = 0; i < SDHR_CMD_COUNT; i++)
+	{
+		if ((size_t)SDHRCommandTable[i].id != i)
+			return false;
+	}
+	return true;
+}
+static_assert(SDHRCommandTableIsIndexedById(), "SDHRCommandTable entries must be in SDHR_CMD order");
+
+// Looks up the table entry for a command id, or returns nullptr if the id or its layout is unknown
+inline const SDHRCommandInfo* SDHRGetCommandInfo(uint8_t id)
 {
-public:
-	SDHRCommand_DefineTileset(DefineTilesetCmd* cmd);
-};
-
-class SDHRCommand_DefineTilesetImmediate : public SDHRCommand
-{
-public:
-	SDHRCommand_DefineTilesetImmediate(DefineTilesetImmediateCmd *cmd);
-};
+	return (id < SDHR_CMD_COUNT && SDHRCommandTable[id].payload != SDHRPayload::UNKNOWN) ? &SDHRCommandTable[id] : nullptr;
+}
 
-class SDHRCommand_DefineWindow : public SDHRCommand
+/**
+ * @brief SDHRCommandLayout
+ * Binds a command struct to its SDHR_CMD, and through it to its SDHRCommandTable entry.
+ * Size() and Encode() are generated from the entry's payload rule.
+*/
+template <typename T> struct SDHRCommandId;
+
+#define SDHR_COMMAND_STRUCT(T, ID) \
+	template <> struct SDHRCommandId<T> { static constexpr SDHR_CMD id = SDHR_CMD::ID; };
+
+SDHR_COMMAND_STRUCT(UploadDataCmd, UPLOAD_DATA)
+SDHR_COMMAND_STRUCT(UploadDataFilenameCmd, UPLOAD_DATA_FILENAME)
+SDHR_COMMAND_STRUCT(DefineImageAssetCmd, DEFINE_IMAGE_ASSET)
+SDHR_COMMAND_STRUCT(DefineImageAssetFilenameCmd, DEFINE_IMAGE_ASSET_FILENAME)
+SDHR_COMMAND_STRUCT(DefineTilesetCmd, DEFINE_TILESET)
+SDHR_COMMAND_STRUCT(DefineTilesetImmediateCmd, DEFINE_TILESET_IMMEDIATE)
+SDHR_COMMAND_STRUCT(DefineWindowCmd, DEFINE_WINDOW)
+SDHR_COMMAND_STRUCT(UpdateWindowSetBothCmd, UPDATE_WINDOW_SET_BOTH)
+SDHR_COMMAND_STRUCT(UpdateWindowSetUploadCmd, UPDATE_WINDOW_SET_UPLOAD)
+SDHR_COMMAND_STRUCT(UpdateWindowSingleTilesetCmd, UPDATE_WINDOW_SINGLE_TILESET)
+SDHR_COMMAND_STRUCT(UpdateWindowShiftTilesCmd, UPDATE_WINDOW_SHIFT_TILES)
+SDHR_COMMAND_STRUCT(UpdateWindowSetWindowPositionCmd, UPDATE_WINDOW_SET_WINDOW_POSITION)
+SDHR_COMMAND_STRUCT(UpdateWindowAdjustWindowViewCmd, UPDATE_WINDOW_ADJUST_WINDOW_VIEW)
+SDHR_COMMAND_STRUCT(UpdateWindowEnableCmd, UPDATE_WINDOW_ENABLE)
+SDHR_COMMAND_STRUCT(UploadDataCompressedCmd, UPLOAD_DATA_COMPRESSED)
+SDHR_COMMAND_STRUCT(UpdateWindowSetBothCompressedCmd, UPDATE_WINDOW_SET_BOTH_COMPRESSED)
+
+#undef SDHR_COMMAND_STRUCT
+
+template <typename T>
+struct SDHRCommandLayout
 {
-public:
-	SDHRCommand_DefineWindow(DefineWindowCmd* cmd);
+	static constexpr SDHR_CMD id = SDHRCommandId<T>::id;
+	static constexpr SDHRCommandInfo info = SDHRCommandTable[(size_t)id];
+	static constexpr size_t fixed_size = info.fixed_size;
+
+	// the fixed header is everything but the trailing pointer to the payload
+	static_assert(fixed_size == sizeof(T) - (info.payload == SDHRPayload::NONE ? 0 : sizeof(void*)),
+		"SDHRCommandTable fixed_size doesn't match the command struct");
+
+	static size_t PayloadSize(const T& cmd)
+	{
+		if constexpr (info.payload == SDHRPayload::FILENAME)
+			return cmd.filename_length;
+		else if constexpr (info.payload == SDHRPayload::TILESET_ENTRIES)
+			return (size_t)4 * ((cmd.num_entries == 0) ? 256 : cmd.num_entries);
+		else if constexpr (info.payload == SDHRPayload::TILES_1B)
+			return (size_t)cmd.tile_xcount * cmd.tile_ycount;
+		else if constexpr (info.payload == SDHRPayload::TILES_2B)
+			return (size_t)cmd.tile_xcount * cmd.tile_ycount * 2;
+		else if constexpr (info.payload == SDHRPayload::DATA_LENGTH)
+			return cmd.data_length;
+		else
+			return 0;
+	}
+
+	static const void* Payload(const T& cmd)
+	{
+		if constexpr (info.payload == SDHRPayload::FILENAME)
+			return cmd.filename;
+		else if constexpr (info.payload == SDHRPayload::NONE)
+			return nullptr;
+		else
+			return cmd.data;
+	}
+
+	// Bytes the command takes after its size header: id byte, fixed header, payload
+	static size_t Size(const T& cmd)
+	{
+		return 1 + fixed_size + PayloadSize(cmd);
+	}
+
+	// Writes the id byte, fixed header and payload to dest, which must hold Size(cmd) bytes
+	static void Encode(const T& cmd, uint8_t* dest)
+	{
+		dest[0] = (uint8_t)id;
+		memcpy(dest + 1, &cmd, fixed_size);
+		if constexpr (info.payload != SDHRPayload::NONE)
+			memcpy(dest + 1 + fixed_size, Payload(cmd), PayloadSize(cmd));
+	}
 };
 
-class SDHRCommand_UpdateWindowSetBoth : public SDHRCommand
+/**
+ * @brief SDHRCommand
+ * Superclass of all SDHR commands
+ * Each SDHR command is constructed with a pointer to its command struct, and any data it points to.
+ * It doesn't copy anything: the command is encoded when it's added to a SDHRCommandBatcher,
+ * so the struct and its data only need to live until then.
+*/
+class SDHRCommand
 {
 public:
-	SDHRCommand_UpdateWindowSetBoth(UpdateWindowSetBothCmd* cmd);
-};
+	SDHR_CMD id = SDHR_CMD::NONE;
 
-class SDHRCommand_UpdateWindowSetUpload : public SDHRCommand
-{
-public:
-	SDHRCommand_UpdateWindowSetUpload(UpdateWindowSetUploadCmd* cmd);
-};
+	// Number of bytes the command takes in the batch after its 2-byte size header:
+	// the id byte followed by the command body
+	virtual size_t Size() const = 0;
 
-class SDHRCommand_UpdateWindowSingleTileset : public SDHRCommand
-{
-public:
-	SDHRCommand_UpdateWindowSingleTileset(UpdateWindowSingleTilesetCmd* cmd);
-};
+	// Writes the id byte and the command body to dest, which must hold Size() bytes
+	virtual void Encode(uint8_t* dest) const = 0;
 
-class SDHRCommand_UpdateWindowShiftTiles : public SDHRCommand
-{
-public:
-	SDHRCommand_UpdateWindowShiftTiles(UpdateWindowShiftTilesCmd* cmd);
+	// Encodes the command into the batcher, splitting it if needed
+	virtual bool AddTo(SDHRCommandBatcher& batcher) const = 0;
 };
 
-class SDHRCommand_UpdateWindowSetWindowPosition : public SDHRCommand
+template <typename T>
+class SDHRCommandOf : public SDHRCommand
 {
 public:
-	SDHRCommand_UpdateWindowSetWindowPosition(UpdateWindowSetWindowPositionCmd* cmd);
+	SDHRCommandOf(T* cmd) : cmd(cmd) { id = SDHRCommandLayout<T>::id; };
+	size_t Size() const override { return SDHRCommandLayout<T>::Size(*cmd); };
+	void Encode(uint8_t* dest) const override { SDHRCommandLayout<T>::Encode(*cmd, dest); };
+	bool AddTo(SDHRCommandBatcher& batcher) const override { return batcher.Add(*cmd); };
+private:
+	const T* cmd;
 };
 
-class SDHRCommand_UpdateWindowAdjustWindowView : public SDHRCommand
+using SDHRCommand_UploadData = SDHRCommandOf<UploadDataCmd>;
+using SDHRCommand_UploadDataFilename = SDHRCommandOf<UploadDataFilenameCmd>;
+using SDHRCommand_DefineImageAsset = SDHRCommandOf<DefineImageAssetCmd>;
+using SDHRCommand_DefineImageAssetFilename = SDHRCommandOf<DefineImageAssetFilenameCmd>;
+using SDHRCommand_DefineTileset = SDHRCommandOf<DefineTilesetCmd>;
+using SDHRCommand_DefineTilesetImmediate = SDHRCommandOf<DefineTilesetImmediateCmd>;
+using SDHRCommand_DefineWindow = SDHRCommandOf<DefineWindowCmd>;
+using SDHRCommand_UpdateWindowSetBoth = SDHRCommandOf<UpdateWindowSetBothCmd>;
+using SDHRCommand_UpdateWindowSetUpload = SDHRCommandOf<UpdateWindowSetUploadCmd>;
+using SDHRCommand_UpdateWindowSingleTileset = SDHRCommandOf<UpdateWindowSingleTilesetCmd>;
+using SDHRCommand_UpdateWindowShiftTiles = SDHRCommandOf<UpdateWindowShiftTilesCmd>;
+using SDHRCommand_UpdateWindowSetWindowPosition = SDHRCommandOf<UpdateWindowSetWindowPositionCmd>;
+using SDHRCommand_UpdateWindowAdjustWindowView = SDHRCommandOf<UpdateWindowAdjustWindowViewCmd>;
+using SDHRCommand_UpdateWindowEnable = SDHRCommandOf<UpdateWindowEnableCmd>;
+using SDHRCommand_UploadDataCompressed = SDHRCommandOf<UploadDataCompressedCmd>;
+using SDHRCommand_UpdateWindowSetBothCompressed = SDHRCommandOf<UpdateWindowSetBothCompressedCmd>;
+
+template <typename T>
+bool SDHRCommandBatcher::Add(const T& cmd)
 {
-public:
-	SDHRCommand_UpdateWindowAdjustWindowView(UpdateWindowAdjustWindowViewCmd* cmd);
-};
-
-class SDHRCommand_UpdateWindowEnable : public SDHRCommand
+	using Layout = SDHRCommandLayout<T>;
+	size_t cmd_size = Layout::Size(cmd);
+	if constexpr (Layout::info.payload == SDHRPayload::TILES_1B || Layout::info.payload == SDHRPayload::TILES_2B)
+	{
+		if (2 + cmd_size > GameLink::SDHR_GetMaxWriteLength())
+			return AddSplit(cmd);
+	}
+	uint8_t* p = BeginCommand(cmd_size);
+	if (p == nullptr)
+		return false;
+	Layout::Encode(cmd, p);
+	return true;
+}
+
+template <typename T>
+bool SDHRCommandBatcher::AddSplit(const T& cmd)
 {
-public:
-	SDHRCommand_UpdateWindowEnable(UpdateWindowEnableCmd* cmd);
-};
+	using Layout = SDHRCommandLayout<T>;
+	constexpr size_t tile_bytes = (Layout::info.payload == SDHRPayload::TILES_2B) ? 2 : 1;
+	const size_t max_tiles = (GameLink::SDHR_GetMaxWriteLength() - 2 - 1 - Layout::fixed_size) / tile_bytes;
+	// copies, as the packed struct members can't be bound to references
+	const uint64_t xcount = cmd.tile_xcount;
+	const uint64_t ycount = cmd.tile_ycount;
+	const uint64_t part_xcount = std::min<uint64_t>(xcount, max_tiles);
+	const uint64_t part_ycount = std::max<uint64_t>(1, max_tiles / part_xcount);
+	const uint8_t* data = (const uint8_t*)cmd.data;
+
+	for (uint64_t y = 0; y < ycount; y += part_ycount)
+	{
+		for (uint64_t x = 0; x < xcount; x += part_xcount)
+		{
+			T part = cmd;
+			part.tile_xbegin = cmd.tile_xbegin + (int64_t)x;
+			part.tile_ybegin = cmd.tile_ybegin + (int64_t)y;
+			part.tile_xcount = std::min(part_xcount, xcount - x);
+			part.tile_ycount = std::min(part_ycount, ycount - y);
+			uint8_t* p = BeginCommand(Layout::Size(part));
+			if (p == nullptr)
+				return false;
+			p[0] = (uint8_t)Layout::id;
+			memcpy(p + 1, &part, Layout::fixed_size);
+			p += 1 + Layout::fixed_size;
+			// the part's tiles are a sub-rectangle of the source rows
+			const uint64_t part_rows = part.tile_ycount;
+			const size_t row_bytes = (size_t)part.tile_xcount * tile_bytes;
+			for (uint64_t row = 0; row < part_rows; row++)
+			{
+				memcpy(p, data + ((y + row) * xcount + x) * tile_bytes, row_bytes);
+				p += row_bytes;
+			}
+		}
+	}
+	return true;
+}
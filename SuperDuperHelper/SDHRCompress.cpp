@@ -0,0 +1,115 @@
+#include "SDHRCompress.h"
+#include <algorithm>
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_BITS = 13;
+
+static uint32_t Hash4(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes what's left of a length that didn't fit in its token nibble
+static uint8_t* WriteLength(uint8_t* op, size_t extra)
+{
+	while (extra >= 255)
+	{
+		*op++ = 255;
+		extra -= 255;
+	}
+	*op++ = (uint8_t)extra;
+	return op;
+}
+
+static uint8_t* WriteLiterals(uint8_t* op, uint8_t* token, const uint8_t* literals, size_t count)
+{
+	*token = (uint8_t)(std::min<size_t>(count, 15) << 4);
+	if (count >= 15)
+		op = WriteLength(op, count - 15);
+	memcpy(op, literals, count);
+	return op + count;
+}
+
+size_t SDHRCompress::CompressLZ(const uint8_t* src, size_t length, uint8_t* dst)
+{
+	// positions + 1 of the last time each hash was seen, 0 when never
+	std::vector<uint32_t> table((size_t)1 << HASH_BITS, 0);
+	uint8_t* op = dst;
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + MIN_MATCH <= length)
+	{
+		const uint32_t h = Hash4(src + i);
+		const size_t candidate = table[h];
+		table[h] = (uint32_t)(i + 1);
+		if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET || memcmp(src + candidate - 1, src + i, MIN_MATCH) != 0)
+		{
+			i++;
+			continue;
+		}
+		const size_t ref = candidate - 1;
+		size_t match = MIN_MATCH;
+		while (i + match < length && src[ref + match] == src[i + match])
+			match++;
+
+		uint8_t* token = op++;
+		op = WriteLiterals(op, token, src + anchor, i - anchor);
+		const size_t offset = i - ref;
+		*op++ = (uint8_t)offset;
+		*op++ = (uint8_t)(offset >> 8);
+		*token |= (uint8_t)std::min<size_t>(match - MIN_MATCH, 15);
+		if (match - MIN_MATCH >= 15)
+			op = WriteLength(op, match - MIN_MATCH - 15);
+
+		// keep the table fresh with the tail of the match, where the next one most likely continues from
+		if (i + match + 2 <= length && match > 2)
+			table[Hash4(src + i + match - 2)] = (uint32_t)(i + match - 2 + 1);
+		i += match;
+		anchor = i;
+	}
+	// the last sequence carries whatever is left as literals, and no match
+	uint8_t* token = op++;
+	op = WriteLiterals(op, token, src + anchor, length - anchor);
+	return op - dst;
+}
+
+size_t SDHRCompress::Compress(SDHR_CODEC codec, const uint8_t* src, size_t length, uint8_t* dst)
+{
+	switch (codec)
+	{
+	case SDHR_CODEC::LZ:
+		return CompressLZ(src, length, dst);
+	case SDHR_CODEC::LZ_PLANAR2:
+	{
+		std::vector<uint8_t> planes(length);
+		const size_t even = (length + 1) / 2;
+		for (size_t i = 0; i < even; i++)
+			planes[i] = src[i * 2];
+		for (size_t i = 0; i < length / 2; i++)
+			planes[even + i] = src[i * 2 + 1];
+		return CompressLZ(planes.data(), length, dst);
+	}
+	default:
+		memcpy(dst, src, length);
+		return length;
+	}
+}
+
+SDHR_CODEC SDHRCompress::CompressBest(const uint8_t* src, size_t length, std::vector<uint8_t>& out)
+{
+	const size_t max_size = MaxCompressedSize(length);
+	out.resize(max_size * 2);
+	const size_t lz = Compress(SDHR_CODEC::LZ, src, length, out.data());
+	const size_t planar = Compress(SDHR_CODEC::LZ_PLANAR2, src, length, out.data() + max_size);
+	if (planar < lz)
+	{
+		memmove(out.data(), out.data() + max_size, planar);
+		out.resize(planar);
+		return SDHR_CODEC::LZ_PLANAR2;
+	}
+	out.resize(lz);
+	return SDHR_CODEC::LZ;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "SDHRDecompress.h"
+#include <vector>
+
+/**
+ * @brief SDHRCompress
+ * Encoder for the SDHR_CODEC formats described in SDHRDecompress.h.
+ * A greedy single-pass LZ with a small hash table: built for speed over ratio,
+ * as it runs on every published batch.
+*/
+class SDHRCompress
+{
+public:
+	// Largest output Compress() can produce for length bytes of input
+	static size_t MaxCompressedSize(size_t length) { return length + length / 255 + 16; };
+
+	// Encodes length bytes of src with codec into dst, which must hold MaxCompressedSize(length) bytes.
+	// Returns the encoded size.
+	static size_t Compress(SDHR_CODEC codec, const uint8_t* src, size_t length, uint8_t* dst);
+
+	// Encodes src with both SDHR_CODEC::LZ and SDHR_CODEC::LZ_PLANAR2, keeps the smaller one in out
+	// and returns its codec
+	static SDHR_CODEC CompressBest(const uint8_t* src, size_t length, std::vector<uint8_t>& out);
+
+private:
+	static size_t CompressLZ(const uint8_t* src, size_t length, uint8_t* dst);
+};
@@ -0,0 +1,269 @@
+#include "SDHRDecoder.h"
+#include <cstdio>
+
+const char* SDHRDecodeErrorName(SDHRDecodeError error)
+{
+	switch (error)
+	{
+	case SDHRDecodeError::NONE: return "none";
+	case SDHRDecodeError::TRUNCATED_SIZE: return "truncated size header";
+	case SDHRDecodeError::TRUNCATED_COMMAND: return "command runs past the end of the batch";
+	case SDHRDecodeError::UNKNOWN_COMMAND: return "unknown command id";
+	case SDHRDecodeError::SHORT_HEADER: return "command shorter than its fixed header";
+	case SDHRDecodeError::PAYLOAD_MISMATCH: return "payload size doesn't match the header";
+	}
+	return "?";
+}
+
+bool SDHRDecoder::PayloadSize(const SDHRCommandInfo& info, const uint8_t* header, size_t& size)
+{
+	switch (info.payload)
+	{
+	case SDHRPayload::NONE:
+		size = 0;
+		return true;
+	case SDHRPayload::FILENAME:
+		size = header[info.count_offset];
+		return true;
+	case SDHRPayload::TILESET_ENTRIES:
+		size = (size_t)4 * ((header[info.count_offset] == 0) ? 256 : header[info.count_offset]);
+		return true;
+	case SDHRPayload::TILES_1B:
+	case SDHRPayload::TILES_2B:
+	{
+		uint64_t xcount, ycount;
+		memcpy(&xcount, header + info.count_offset, 8);
+		memcpy(&ycount, header + info.count_offset + 8, 8);
+		// anything that doesn't fit in 32 bits can't fit in a 16-bit size header either
+		if (xcount > UINT32_MAX || ycount > UINT32_MAX)
+			return false;
+		uint64_t tiles = xcount * ycount;
+		if (tiles > UINT32_MAX)
+			return false;
+		size = (size_t)tiles * ((info.payload == SDHRPayload::TILES_2B) ? 2 : 1);
+		return true;
+	}
+	case SDHRPayload::DATA_LENGTH:
+	{
+		uint16_t data_length;
+		memcpy(&data_length, header + info.count_offset, 2);
+		size = data_length;
+		return true;
+	}
+	case SDHRPayload::UNKNOWN:
+		return false;
+	}
+	return false;
+}
+
+bool SDHRDecoder::Next(SDHRDecodedCommand& cmd)
+{
+	if (error != SDHRDecodeError::NONE || offset == length)
+		return false;
+	if (length - offset < 3)
+	{
+		error = SDHRDecodeError::TRUNCATED_SIZE;
+		return false;
+	}
+	const uint8_t* p = data + offset;
+	uint16_t body;
+	memcpy(&body, p, 2);
+	if ((size_t)body > length - offset - 3)
+	{
+		error = SDHRDecodeError::TRUNCATED_COMMAND;
+		return false;
+	}
+	const SDHRCommandInfo* info = SDHRGetCommandInfo(p[2]);
+	if (info == nullptr)
+	{
+		error = SDHRDecodeError::UNKNOWN_COMMAND;
+		return false;
+	}
+	if (body < info->fixed_size)
+	{
+		error = SDHRDecodeError::SHORT_HEADER;
+		return false;
+	}
+	size_t payload_size;
+	if (!PayloadSize(*info, p + 3, payload_size) || payload_size != (size_t)body - info->fixed_size)
+	{
+		error = SDHRDecodeError::PAYLOAD_MISMATCH;
+		return false;
+	}
+
+	cmd.id = info->id;
+	cmd.info = info;
+	cmd.offset = offset;
+	cmd.size = 3 + (size_t)body;
+	cmd.header = p + 3;
+	cmd.payload = p + 3 + info->fixed_size;
+	cmd.payload_size = payload_size;
+	offset += cmd.size;
+	return true;
+}
+
+bool SDHRDecodeStats::Add(const uint8_t* data, size_t length)
+{
+	SDHRDecoder decoder(data, length);
+	SDHRDecodedCommand cmd;
+	while (decoder.Next(cmd))
+	{
+		commands[(size_t)cmd.id]++;
+		bytes[(size_t)cmd.id] += cmd.size;
+		payload_bytes[(size_t)cmd.id] += cmd.payload_size;
+	}
+	batches++;
+	if (!decoder.IsDone())
+	{
+		malformed++;
+		return false;
+	}
+	return true;
+}
+
+size_t SDHRDecodeStats::TotalBytes() const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < SDHR_CMD_COUNT; i++)
+		total += bytes[i];
+	return total;
+}
+
+std::string SDHRDisassemble(const SDHRDecodedCommand& cmd)
+{
+	char buf[320];
+	int n = snprintf(buf, sizeof(buf), "%06zx %-34s ", cmd.offset, cmd.info->name);
+	char* p = buf + n;
+	const size_t left = sizeof(buf) - n;
+	switch (cmd.id)
+	{
+	case SDHR_CMD::UPLOAD_DATA:
+	{
+		UploadDataCmd c;
+		cmd.As(c);
+		snprintf(p, left, "dest=%02x%02x00 source=%02x00 pages=%u", c.dest_addr_high, c.dest_addr_med, c.source_addr_med, c.num_256b_pages);
+		break;
+	}
+	case SDHR_CMD::UPLOAD_DATA_FILENAME:
+	{
+		UploadDataFilenameCmd c;
+		cmd.As(c);
+		snprintf(p, left, "dest=%02x%02x00 file=\"%.*s\"", c.dest_addr_high, c.dest_addr_med, (int)c.filename_length, c.filename);
+		break;
+	}
+	case SDHR_CMD::DEFINE_IMAGE_ASSET:
+	{
+		DefineImageAssetCmd c;
+		cmd.As(c);
+		snprintf(p, left, "asset=%u upload=%02x%02x00 pages=%u", c.asset_index, c.upload_addr_high, c.upload_addr_med, (unsigned)c.upload_page_count);
+		break;
+	}
+	case SDHR_CMD::DEFINE_IMAGE_ASSET_FILENAME:
+	{
+		DefineImageAssetFilenameCmd c;
+		cmd.As(c);
+		snprintf(p, left, "asset=%u file=\"%.*s\"", c.asset_index, (int)c.filename_length, c.filename);
+		break;
+	}
+	case SDHR_CMD::DEFINE_TILESET:
+	{
+		DefineTilesetCmd c;
+		cmd.As(c);
+		snprintf(p, left, "tileset=%u entries=%u dim=%ux%u asset=%u data=%02x%02x00", c.tileset_index, c.num_entries ? c.num_entries : 256,
+			c.xdim, c.ydim, c.asset_index, c.data_high, c.data_med);
+		break;
+	}
+	case SDHR_CMD::DEFINE_TILESET_IMMEDIATE:
+	{
+		DefineTilesetImmediateCmd c;
+		cmd.As(c);
+		snprintf(p, left, "tileset=%u entries=%u dim=%ux%u asset=%u", c.tileset_index, c.num_entries ? c.num_entries : 256,
+			c.xdim, c.ydim, c.asset_index);
+		break;
+	}
+	case SDHR_CMD::DEFINE_WINDOW:
+	{
+		DefineWindowCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d %s screen=%llux%llu@%lld,%lld view=%lld,%lld tiles=%llux%llu of %llux%llu px",
+			c.window_index, cmd.header[offsetof(DefineWindowCmd, black_or_wrap)] ? "wrap" : "black",
+			(unsigned long long)c.screen_xcount, (unsigned long long)c.screen_ycount, (long long)c.screen_xbegin, (long long)c.screen_ybegin,
+			(long long)c.tile_xbegin, (long long)c.tile_ybegin, (unsigned long long)c.tile_xcount, (unsigned long long)c.tile_ycount,
+			(unsigned long long)c.tile_xdim, (unsigned long long)c.tile_ydim);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_SET_BOTH:
+	{
+		UpdateWindowSetBothCmd c;
+		memcpy(&c, cmd.header, offsetof(UpdateWindowSetBothCmd, data));
+		snprintf(p, left, "window=%d at=%lld,%lld size=%llux%llu", c.window_index, (long long)c.tile_xbegin, (long long)c.tile_ybegin,
+			(unsigned long long)c.tile_xcount, (unsigned long long)c.tile_ycount);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_SINGLE_TILESET:
+	{
+		UpdateWindowSingleTilesetCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d at=%lld,%lld size=%llux%llu tileset=%u", c.window_index, (long long)c.tile_xbegin, (long long)c.tile_ybegin,
+			(unsigned long long)c.tile_xcount, (unsigned long long)c.tile_ycount, c.tileset_index);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_SET_UPLOAD:
+	{
+		UpdateWindowSetUploadCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d at=%lld,%lld size=%llux%llu upload=%02x%02x00", c.window_index, (long long)c.tile_xbegin, (long long)c.tile_ybegin,
+			(unsigned long long)c.tile_xcount, (unsigned long long)c.tile_ycount, c.upload_addr_high, c.upload_addr_med);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_SHIFT_TILES:
+	{
+		UpdateWindowShiftTilesCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d dir=%d,%d", c.window_index, c.x_dir, c.y_dir);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_SET_WINDOW_POSITION:
+	{
+		UpdateWindowSetWindowPositionCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d screen=%lld,%lld", c.window_index, (long long)c.screen_xbegin, (long long)c.screen_ybegin);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_ADJUST_WINDOW_VIEW:
+	{
+		UpdateWindowAdjustWindowViewCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d view=%lld,%lld", c.window_index, (long long)c.tile_xbegin, (long long)c.tile_ybegin);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_ENABLE:
+	{
+		UpdateWindowEnableCmd c;
+		cmd.As(c);
+		// bools are read as bytes, anything on the wire isn't necessarily a valid bool
+		snprintf(p, left, "window=%d %s", c.window_index, cmd.header[offsetof(UpdateWindowEnableCmd, enabled)] ? "on" : "off");
+		break;
+	}
+	case SDHR_CMD::UPLOAD_DATA_COMPRESSED:
+	{
+		UploadDataCompressedCmd c;
+		cmd.As(c);
+		snprintf(p, left, "dest=%02x%02x00 codec=%u %u->%u bytes", c.dest_addr_high, c.dest_addr_med, c.codec,
+			(unsigned)c.data_length, (unsigned)c.decompressed_length);
+		break;
+	}
+	case SDHR_CMD::UPDATE_WINDOW_SET_BOTH_COMPRESSED:
+	{
+		UpdateWindowSetBothCompressedCmd c;
+		cmd.As(c);
+		snprintf(p, left, "window=%d at=%lld,%lld size=%llux%llu codec=%u %u bytes", c.window_index, (long long)c.tile_xbegin, (long long)c.tile_ybegin,
+			(unsigned long long)c.tile_xcount, (unsigned long long)c.tile_ycount, c.codec, (unsigned)c.data_length);
+		break;
+	}
+	default:
+		*p = 0;
+		break;
+	}
+	return std::string(buf);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "SDHRCommand.h"
+#include <string>
+
+/**
+ * @brief SDHRDecoder
+ * Walks an encoded batch, as published, command by command without allocating.
+ * Every command is checked against its SDHRCommandTable entry: the size header must hold the fixed header,
+ * and the payload its rule asks for, exactly. Decoding stops at the first command that doesn't,
+ * and GetError() tells why.
+*/
+
+enum class SDHRDecodeError : uint8_t {
+	NONE,
+	TRUNCATED_SIZE,		// fewer than 3 bytes left for the size header and id
+	TRUNCATED_COMMAND,	// the size header runs past the end of the batch
+	UNKNOWN_COMMAND,	// no SDHRCommandTable entry for the id, or no known layout
+	SHORT_HEADER,		// smaller than the command's fixed header
+	PAYLOAD_MISMATCH,	// the payload isn't the size the fixed header says it is
+};
+
+const char* SDHRDecodeErrorName(SDHRDecodeError error);
+
+struct SDHRDecodedCommand
+{
+	SDHR_CMD id = SDHR_CMD::NONE;
+	const SDHRCommandInfo* info = nullptr;
+	size_t offset = 0;				// of the size header in the batch
+	size_t size = 0;				// bytes in the batch, size header included
+	const uint8_t* header = nullptr;	// fixed header, info->fixed_size bytes
+	const uint8_t* payload = nullptr;
+	size_t payload_size = 0;
+
+	// Copies the fixed header into the command struct, and points its data at the payload.
+	// Returns false if the command isn't a T.
+	template <typename T>
+	bool As(T& cmd) const;
+};
+
+class SDHRDecoder
+{
+public:
+	SDHRDecoder(const uint8_t* data, size_t length) : data(data), length(length) {};
+
+	// Decodes the next command. Returns false at the end of the batch, or on an error.
+	bool Next(SDHRDecodedCommand& cmd);
+
+	// True once the whole batch has been decoded without error
+	bool IsDone() const { return offset == length && error == SDHRDecodeError::NONE; };
+	SDHRDecodeError GetError() const { return error; };
+	size_t GetOffset() const { return offset; };
+
+	// Payload size the command's rule asks for, given its fixed header.
+	// Returns false if it overflows.
+	static bool PayloadSize(const SDHRCommandInfo& info, const uint8_t* header, size_t& size);
+
+private:
+	const uint8_t* data;
+	size_t length;
+	size_t offset = 0;
+	SDHRDecodeError error = SDHRDecodeError::NONE;
+};
+
+/**
+ * @brief SDHRDecodeStats
+ * Per command byte accounting of decoded batches
+*/
+struct SDHRDecodeStats
+{
+	size_t batches = 0;
+	size_t malformed = 0;						// batches that didn't decode to the end
+	size_t commands[SDHR_CMD_COUNT] = {};
+	size_t bytes[SDHR_CMD_COUNT] = {};			// size headers included
+	size_t payload_bytes[SDHR_CMD_COUNT] = {};
+
+	// Decodes a batch and adds it to the counts. Returns false if it's malformed.
+	bool Add(const uint8_t* data, size_t length);
+	size_t TotalBytes() const;
+};
+
+// One line describing the command and its fixed header fields, without the payload
+std::string SDHRDisassemble(const SDHRDecodedCommand& cmd);
+
+template <typename T>
+bool SDHRDecodedCommand::As(T& cmd) const
+{
+	using Layout = SDHRCommandLayout<T>;
+	if (id != Layout::id)
+		return false;
+	memcpy(&cmd, header, Layout::fixed_size);
+	if constexpr (Layout::info.payload == SDHRPayload::FILENAME)
+		cmd.filename = (const char*)payload;
+	else if constexpr (Layout::info.payload != SDHRPayload::NONE)
+		cmd.data = const_cast<uint8_t*>(payload);
+	return true;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief SDHRDecompress
+ * Reference decoder for the payloads of UPLOAD_DATA_COMPRESSED and UPDATE_WINDOW_SET_BOTH_COMPRESSED.
+ * Self-contained on purpose: the emulator side can take this header as is.
+ *
+ * SDHR_CODEC::LZ is a stream of sequences, each:
+ *   token         high nibble: literal count, low nibble: match length - 4
+ *   [count bytes] when the literal count nibble is 15, bytes of 255 and a final byte < 255 are added to it
+ *   literals
+ *   offset        uint16_t little endian, 1 to 65535 bytes back into the output
+ *   [len bytes]   when the match nibble is 15, extended like the literal count
+ * The last sequence ends after its literals, with no offset. Matches may overlap their own output,
+ * which is how runs are encoded.
+ * SDHR_CODEC::LZ_PLANAR2 is SDHR_CODEC::LZ applied to the even bytes followed by the odd bytes,
+ * which suits 2-byte records such as (tileset, index) tiles.
+*/
+
+enum class SDHR_CODEC : uint8_t {
+	RAW = 0,
+	LZ = 1,
+	LZ_PLANAR2 = 2,
+};
+
+// Decodes a SDHR_CODEC::LZ stream into exactly dst_len bytes.
+// Returns false if the stream is malformed or doesn't decode to exactly dst_len bytes.
+inline bool SDHRDecompressLZ(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len)
+{
+	const uint8_t* ip = src;
+	const uint8_t* const ip_end = src + src_len;
+	size_t op = 0;
+	while (ip < ip_end)
+	{
+		const uint8_t token = *ip++;
+		size_t literals = token >> 4;
+		if (literals == 15)
+		{
+			uint8_t b;
+			do {
+				if (ip >= ip_end)
+					return false;
+				b = *ip++;
+				literals += b;
+			} while (b == 255);
+		}
+		if (literals > (size_t)(ip_end - ip) || literals > dst_len - op)
+			return false;
+		memcpy(dst + op, ip, literals);
+		ip += literals;
+		op += literals;
+		if (ip == ip_end)
+			break;	// last sequence
+
+		if (ip_end - ip < 2)
+			return false;
+		const size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t match = (token & 15) + 4;
+		if ((token & 15) == 15)
+		{
+			uint8_t b;
+			do {
+				if (ip >= ip_end)
+					return false;
+				b = *ip++;
+				match += b;
+			} while (b == 255);
+		}
+		if (offset == 0 || offset > op || match > dst_len - op)
+			return false;
+		// byte by byte, as the match may overlap what it produces
+		const uint8_t* from = dst + op - offset;
+		for (size_t i = 0; i < match; i++)
+			dst[op + i] = from[i];
+		op += match;
+	}
+	return op == dst_len;
+}
+
+// Decodes a payload of the given codec into exactly dst_len bytes. Returns false if it's malformed.
+inline bool SDHRDecompress(SDHR_CODEC codec, const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len)
+{
+	switch (codec)
+	{
+	case SDHR_CODEC::RAW:
+		if (src_len != dst_len)
+			return false;
+		memcpy(dst, src, dst_len);
+		return true;
+	case SDHR_CODEC::LZ:
+		return SDHRDecompressLZ(src, src_len, dst, dst_len);
+	case SDHR_CODEC::LZ_PLANAR2:
+	{
+		std::vector<uint8_t> planes(dst_len);
+		if (!SDHRDecompressLZ(src, src_len, planes.data(), dst_len))
+			return false;
+		// the first (dst_len + 1) / 2 bytes are the even plane
+		const size_t even = (dst_len + 1) / 2;
+		for (size_t i = 0; i < even; i++)
+			dst[i * 2] = planes[i];
+		for (size_t i = 0; i < dst_len / 2; i++)
+			dst[i * 2 + 1] = planes[even + i];
+		return true;
+	}
+	default:
+		return false;
+	}
+}
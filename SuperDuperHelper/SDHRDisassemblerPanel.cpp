@@ -0,0 +1,130 @@
+#include "SDHRDisassemblerPanel.h"
+#include "imgui.h"
+#include "misc/cpp/imgui_stdlib.h"
+#include <cstdio>
+
+void SDHRDisassemblerPanel::Select(size_t record)
+{
+	selected = record;
+	v_lines.clear();
+	selected_stats = SDHRDecodeStats();
+	selected_error.clear();
+	const SDHRTrace::Entry entry = trace.Get(record);
+	SDHRDecoder decoder(entry.data, entry.length);
+	SDHRDecodedCommand cmd;
+	while (decoder.Next(cmd))
+		v_lines.push_back(SDHRDisassemble(cmd));
+	if (!decoder.IsDone())
+	{
+		selected_error = std::string("at offset ") + std::to_string(decoder.GetOffset()) + ": " + SDHRDecodeErrorName(decoder.GetError());
+		v_lines.push_back("ERROR " + selected_error);
+	}
+	selected_stats.Add(entry.data, entry.length);
+}
+
+void SDHRDisassemblerPanel::DrawAccounting(const char* id, const SDHRDecodeStats& stats)
+{
+	const size_t total = stats.TotalBytes();
+	if (!ImGui::BeginTable(id, 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+		return;
+	ImGui::TableSetupColumn("Command");
+	ImGui::TableSetupColumn("Count");
+	ImGui::TableSetupColumn("Bytes");
+	ImGui::TableSetupColumn("Payload");
+	ImGui::TableSetupColumn("Share");
+	ImGui::TableHeadersRow();
+	for (size_t i = 0; i < SDHR_CMD_COUNT; i++)
+	{
+		if (stats.commands[i] == 0)
+			continue;
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::TextUnformatted(SDHRCommandTable[i].name);
+		ImGui::TableNextColumn();
+		ImGui::Text("%zu", stats.commands[i]);
+		ImGui::TableNextColumn();
+		ImGui::Text("%zu", stats.bytes[i]);
+		ImGui::TableNextColumn();
+		ImGui::Text("%zu", stats.payload_bytes[i]);
+		ImGui::TableNextColumn();
+		ImGui::Text("%.1f%%", total ? (100.0 * stats.bytes[i] / total) : 0.0);
+	}
+	ImGui::EndTable();
+}
+
+void SDHRDisassemblerPanel::Draw(const char* title, bool* p_open)
+{
+	ImGui::SetNextWindowSize(ImVec2(640.f, 480.f), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin(title, p_open))
+	{
+		ImGui::End();
+		return;
+	}
+
+	if (ImGui::CollapsingHeader("Live", ImGuiTreeNodeFlags_DefaultOpen))
+	{
+		bool validate = SDHRSender::Instance().IsValidate();
+		if (ImGui::Checkbox("Decode every published batch", &validate))
+			SDHRSender::Instance().SetValidate(validate);
+		SDHRDecodeStats live;
+		SDHRSender::Instance().GetDecodeStats(live);
+		ImGui::Text("%zu batches decoded, %zu malformed, %zu bytes", live.batches, live.malformed, live.TotalBytes());
+		DrawAccounting("live_accounting", live);
+	}
+
+	if (ImGui::CollapsingHeader("Trace", ImGuiTreeNodeFlags_DefaultOpen))
+	{
+		ImGui::InputText("##trace_path", &trace_path);
+		ImGui::SameLine();
+		if (ImGui::Button("Load"))
+		{
+			loaded = trace.Load(trace_path);
+			selected = SIZE_MAX;
+			v_lines.clear();
+		}
+		if (!loaded)
+		{
+			ImGui::TextUnformatted("No trace loaded");
+			ImGui::End();
+			return;
+		}
+		ImGui::Text("%zu batches", trace.Count());
+
+		// batch list on the left, the selected batch on the right
+		ImGui::BeginChild("batches", ImVec2(220.f, 0.f), true);
+		ImGuiListClipper clipper;
+		clipper.Begin((int)trace.Count());
+		while (clipper.Step())
+		{
+			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+			{
+				const SDHRTrace::Entry entry = trace.Get(i);
+				char label[96];
+				snprintf(label, sizeof(label), "#%d %.3fs f%u %ub", i, entry.timestamp_ns / 1e9, entry.frame, entry.length);
+				if (ImGui::Selectable(label, selected == (size_t)i))
+					Select(i);
+			}
+		}
+		ImGui::EndChild();
+		ImGui::SameLine();
+
+		ImGui::BeginChild("batch", ImVec2(0.f, 0.f), true, ImGuiWindowFlags_HorizontalScrollbar);
+		if (selected != SIZE_MAX)
+		{
+			const SDHRTrace::Entry entry = trace.Get(selected);
+			ImGui::Text("Batch #%zu: %u bytes, %zu commands", selected, entry.length, v_lines.size());
+			if (!selected_error.empty())
+				ImGui::TextColored(ImVec4(1.f, 0.4f, 0.4f, 1.f), "Malformed %s", selected_error.c_str());
+			DrawAccounting("batch_accounting", selected_stats);
+			ImGuiListClipper lines;
+			lines.Begin((int)v_lines.size());
+			while (lines.Step())
+			{
+				for (int i = lines.DisplayStart; i < lines.DisplayEnd; i++)
+					ImGui::TextUnformatted(v_lines[i].c_str());
+			}
+		}
+		ImGui::EndChild();
+	}
+	ImGui::End();
+}
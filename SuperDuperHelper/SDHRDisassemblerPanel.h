@@ -0,0 +1,30 @@
+#pragma once
+#include "SDHRDecoder.h"
+#include "SDHRTrace.h"
+#include <string>
+#include <vector>
+
+/**
+ * @brief SDHRDisassemblerPanel
+ * ImGui window listing the batches of a trace file and disassembling the selected one,
+ * with per command byte accounting for the batch, and for everything the sender validated live.
+*/
+class SDHRDisassemblerPanel
+{
+public:
+	void Draw(const char* title, bool* p_open);
+
+	void SetTracePath(const std::string& path) { trace_path = path; };
+
+private:
+	void Select(size_t record);
+	static void DrawAccounting(const char* id, const SDHRDecodeStats& stats);
+
+	std::string trace_path = "sdhr_trace.bin";
+	SDHRTrace trace;
+	bool loaded = false;
+	size_t selected = SIZE_MAX;
+	std::vector<std::string> v_lines;		// disassembly of the selected batch
+	SDHRDecodeStats selected_stats;
+	std::string selected_error;
+};
@@ -0,0 +1,33 @@
+#include "SDHRPreparedBatch.h"
+#include "SDHRTrace.h"
+#include "SDHRResidencyCache.h"
+
+SDHRPreparedBatch::SDHRPreparedBatch(const SDHRCommandBatcher& batcher)
+	: v_data(batcher.Data(), batcher.Data() + batcher.Size()), v_offsets(batcher.Offsets())
+{
+}
+
+uint8_t* SDHRPreparedBatch::Payload(size_t command)
+{
+	if (PayloadSize(command) == 0)
+		return nullptr;
+	const uint8_t id = v_data[v_offsets[command] + 2];
+	return v_data.data() + HeaderOffset(command) + SDHRCommandTable[id].fixed_size;
+}
+
+size_t SDHRPreparedBatch::PayloadSize(size_t command) const
+{
+	if (command >= v_offsets.size())
+		return 0;
+	const uint8_t id = v_data[v_offsets[command] + 2];
+	return CommandEnd(command) - HeaderOffset(command) - SDHRCommandTable[id].fixed_size;
+}
+
+std::future<SDHRPublishStats> SDHRPreparedBatch::Publish(int32_t target_frame)
+{
+	// sent as is, but what it uploads or defines still has to be known
+	SDHRResidencyCache::Instance().Filter(v_data.data(), v_data.size(), v_offsets, nullptr);
+	if (SDHRTraceRecorder::Instance().IsRecording())
+		SDHRTraceRecorder::Instance().Append(v_data.data(), v_data.size(), v_offsets.size());
+	return SDHRSender::Instance().Submit(v_data.data(), v_data.size(), v_offsets, target_frame);
+}
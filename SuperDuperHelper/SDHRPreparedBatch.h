@@ -0,0 +1,90 @@
+#pragma once
+#include "SDHRCommand.h"
+
+/**
+ * @brief SDHRPreparedBatch
+ * A batch encoded once and published as many times as needed, for batches that keep the same
+ * shape from frame to frame and only change a few values, like sprite windows moving around.
+ * Fields of its commands are patched in place through handles taken once, so republishing
+ * is a few stores and no encoding. Payloads can be patched in place too, but never resized.
+ *
+ *     SDHRPreparedBatch sprites(batcher);
+ *     auto x = SDHR_PREPARED_FIELD(sprites, 3, UpdateWindowSetWindowPositionCmd, screen_xbegin);
+ *     ...
+ *     sprites.Set(x, new_x);
+ *     sprites.Publish();
+*/
+
+// Handle to a field of type V of one of the batch's commands
+template <typename V>
+struct SDHRField
+{
+	uint32_t offset = UINT32_MAX;	// in the batch
+	bool IsValid() const { return offset != UINT32_MAX; };
+};
+
+// Handle to the member of command number command, which must be a T
+#define SDHR_PREPARED_FIELD(batch, command, T, member) \
+	(batch).Field<decltype(T::member)>((command), SDHRCommandLayout<T>::id, offsetof(T, member))
+
+class SDHRPreparedBatch
+{
+public:
+	// Takes a copy of the commands encoded so far in the batcher, which can then be cleared or reused
+	SDHRPreparedBatch(const SDHRCommandBatcher& batcher);
+
+	// Use SDHR_PREPARED_FIELD() rather than this directly.
+	// Returns an invalid handle if the command doesn't exist, isn't the command id,
+	// or the field isn't within its fixed header.
+	template <typename V>
+	SDHRField<V> Field(size_t command, SDHR_CMD id, size_t field_offset) const;
+
+	template <typename V>
+	void Set(SDHRField<V> field, V value)
+	{
+		if (field.IsValid())
+			memcpy(v_data.data() + field.offset, &value, sizeof(V));
+	};
+
+	template <typename V>
+	V Get(SDHRField<V> field) const
+	{
+		V value = V();
+		if (field.IsValid())
+			memcpy(&value, v_data.data() + field.offset, sizeof(V));
+		return value;
+	};
+
+	// The payload of a command, or nullptr if it has none. Its size can't change.
+	uint8_t* Payload(size_t command);
+	size_t PayloadSize(size_t command) const;
+
+	// Publishes the batch as it is now, see SDHRCommandBatcher::Publish()
+	std::future<SDHRPublishStats> Publish(int32_t target_frame = SDHRSender::NEXT_FRAME);
+
+	const uint8_t* Data() const { return v_data.data(); };
+	size_t Size() const { return v_data.size(); };
+	size_t CommandCount() const { return v_offsets.size(); };
+
+private:
+	// Offset of the command's fixed header, just after its id byte
+	size_t HeaderOffset(size_t command) const { return v_offsets[command] + 3; };
+	size_t CommandEnd(size_t command) const { return (command + 1 < v_offsets.size()) ? v_offsets[command + 1] : v_data.size(); };
+
+	std::vector<uint8_t> v_data;
+	std::vector<uint32_t> v_offsets;
+};
+
+template <typename V>
+SDHRField<V> SDHRPreparedBatch::Field(size_t command, SDHR_CMD id, size_t field_offset) const
+{
+	SDHRField<V> field;
+	if (command >= v_offsets.size() || v_data[v_offsets[command] + 2] != (uint8_t)id
+		|| field_offset + sizeof(V) > SDHRCommandTable[(size_t)id].fixed_size)
+	{
+		OutputDebugStringW(L"ERROR: No such field in the prepared SDHR batch!\n");
+		return field;
+	}
+	field.offset = (uint32_t)(HeaderOffset(command) + field_offset);
+	return field;
+}
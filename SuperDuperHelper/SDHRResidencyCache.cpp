@@ -0,0 +1,173 @@
+#include "SDHRResidencyCache.h"
+#include <iterator>
+
+SDHRResidencyCache& SDHRResidencyCache::Instance()
+{
+	static SDHRResidencyCache cache;
+	return cache;
+}
+
+void SDHRResidencyCache::Filter(const uint8_t* data, size_t length, const std::vector<uint32_t>& v_offsets, std::vector<bool>* v_keep)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	const uint32_t current_generation = GameLink::SDHR_GetStateGeneration();
+	const uint64_t current_failed = SDHRSender::Instance().GetFailedCount();
+	if (invalid || current_generation != generation || current_failed != failed_count)
+	{
+		for (auto& slot : assets)
+			slot = Slot();
+		for (auto& slot : tilesets)
+			slot = Slot();
+		ranges.clear();
+		generation = current_generation;
+		failed_count = current_failed;
+		invalid = false;
+	}
+
+	const size_t count = v_offsets.size();
+	if (v_keep)
+		v_keep->assign(count, true);
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint8_t* cmd = data + v_offsets[i];
+		const size_t end = (i + 1 < count) ? v_offsets[i + 1] : length;
+		const SDHRCommandInfo* info = SDHRGetCommandInfo(cmd[2]);
+		if (info == nullptr)
+			continue;
+		const uint8_t* header = cmd + 3;
+		const uint8_t* payload = header + info->fixed_size;
+		const bool changes = Apply(info->id, header, payload, data + end - payload);
+		if (v_keep)
+			(*v_keep)[i] = changes;
+	}
+}
+
+void SDHRResidencyCache::Invalidate()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	invalid = true;
+}
+
+bool SDHRResidencyCache::Apply(SDHR_CMD id, const uint8_t* header, const uint8_t* payload, size_t payload_size)
+{
+	switch (id)
+	{
+	case SDHR_CMD::UPLOAD_DATA:
+	{
+		UploadDataCmd c;
+		memcpy(&c, header, sizeof(c));
+		ForgetPages(c.dest_addr_med | (c.dest_addr_high << 8), c.num_256b_pages);
+		return true;
+	}
+	case SDHR_CMD::UPLOAD_DATA_FILENAME:
+	{
+		UploadDataFilenameCmd c;
+		memcpy(&c, header, offsetof(UploadDataFilenameCmd, filename));
+		return WritePages(c.dest_addr_med | (c.dest_addr_high << 8), UNKNOWN_EXTENT, SDHRHash(payload, payload_size), payload_size);
+	}
+	case SDHR_CMD::UPLOAD_DATA_COMPRESSED:
+	{
+		UploadDataCompressedCmd c;
+		memcpy(&c, header, offsetof(UploadDataCompressedCmd, data));
+		if (c.decompressed_length == 0)
+			return true;
+		// the same data always compresses the same way, so the payload identifies it as well
+		const uint64_t content = SDHRHash(payload, payload_size, SDHRHash(header, offsetof(UploadDataCompressedCmd, data)));
+		const uint32_t pages = (uint32_t)((c.decompressed_length + 255) / 256);
+		return WritePages(c.dest_addr_med | (c.dest_addr_high << 8), pages, content, payload_size);
+	}
+	case SDHR_CMD::DEFINE_IMAGE_ASSET:
+	{
+		DefineImageAssetCmd c;
+		memcpy(&c, header, sizeof(c));
+		uint64_t pages;
+		const bool known = PagesContent(c.upload_addr_med | (c.upload_addr_high << 8), c.upload_page_count, pages);
+		return SetSlot(assets[c.asset_index], known, SDHRHash(header, sizeof(c), pages), sizeof(c));
+	}
+	case SDHR_CMD::DEFINE_IMAGE_ASSET_FILENAME:
+		return SetSlot(assets[header[0]], true, SDHRHash(payload, payload_size, 1), payload_size);
+	case SDHR_CMD::DEFINE_TILESET:
+	{
+		DefineTilesetCmd c;
+		memcpy(&c, header, sizeof(c));
+		const Slot& asset = assets[c.asset_index];
+		const size_t entries = c.num_entries ? c.num_entries : 256;
+		uint64_t pages;
+		const bool known = asset.known && PagesContent(c.data_med | (c.data_high << 8), (uint32_t)((entries * 4 + 255) / 256), pages);
+		return SetSlot(tilesets[c.tileset_index], known, SDHRHash(header, sizeof(c), SDHRHashCombine(asset.content, pages)), sizeof(c));
+	}
+	case SDHR_CMD::DEFINE_TILESET_IMMEDIATE:
+	{
+		DefineTilesetImmediateCmd c;
+		memcpy(&c, header, offsetof(DefineTilesetImmediateCmd, data));
+		const Slot& asset = assets[c.asset_index];
+		const uint64_t content = SDHRHash(payload, payload_size, SDHRHash(header, offsetof(DefineTilesetImmediateCmd, data), asset.content));
+		return SetSlot(tilesets[c.tileset_index], asset.known, content, payload_size);
+	}
+	default:
+		// window state changes all the time, and isn't worth tracking
+		return true;
+	}
+}
+
+bool SDHRResidencyCache::PagesContent(uint32_t first_page, uint32_t page_count, uint64_t& content) const
+{
+	content = 0;
+	if (page_count == 0)
+		return true;
+	auto it = ranges.upper_bound(first_page);
+	if (it == ranges.begin())
+		return false;
+	--it;
+	const uint64_t end = (uint64_t)first_page + page_count;
+	uint64_t covered = it->first;
+	for (; it != ranges.end() && covered < end; ++it)
+	{
+		if (it->first != covered)
+			return false;	// a gap that was never written
+		content = SDHRHashCombine(content, SDHRHashCombine(it->second.content, it->first));
+		if (it->second.page_count == UNKNOWN_EXTENT)
+			return true;	// nothing is known after a file, so it covers the rest
+		covered += it->second.page_count;
+	}
+	if (covered < end)
+		return false;
+	content = SDHRHashCombine(content, first_page);
+	content = SDHRHashCombine(content, page_count);
+	return true;
+}
+
+void SDHRResidencyCache::ForgetPages(uint32_t first_page, uint32_t page_count)
+{
+	const uint64_t end = (page_count == UNKNOWN_EXTENT) ? UINT64_MAX : (uint64_t)first_page + page_count;
+	auto it = ranges.upper_bound(first_page);
+	if (it != ranges.begin())
+	{
+		// the range starting before may reach into the pages
+		auto prev = std::prev(it);
+		if (prev->second.page_count == UNKNOWN_EXTENT || (uint64_t)prev->first + prev->second.page_count > first_page)
+			ranges.erase(prev);
+	}
+	while (it != ranges.end() && it->first < end)
+		it = ranges.erase(it);
+}
+
+bool SDHRResidencyCache::WritePages(uint32_t first_page, uint32_t page_count, uint64_t content, size_t length)
+{
+	auto it = ranges.find(first_page);
+	if (it != ranges.end() && it->second.page_count == page_count && it->second.content == content && it->second.length == length)
+		return false;
+	ForgetPages(first_page, page_count);
+	ranges[first_page] = { page_count, content, length };
+	return true;
+}
+
+bool SDHRResidencyCache::SetSlot(Slot& slot, bool known, uint64_t content, size_t length)
+{
+	if (known && slot.known && slot.content == content && slot.length == length)
+		return false;
+	slot.known = known;
+	slot.content = content;
+	slot.length = length;
+	return true;
+}
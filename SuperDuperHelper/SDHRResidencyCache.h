@@ -0,0 +1,72 @@
+#pragma once
+#include "SDHRCommand.h"
+#include "SDHRHash.h"
+#include <map>
+#include <mutex>
+
+/**
+ * @brief SDHRResidencyCache
+ * Mirrors what the emulator holds, by content hash: image assets, tilesets and the uploaded ranges of
+ * upload memory. Commands that would only put back what's already there are dropped before they're sent,
+ * so setting up the same scene again costs next to nothing.
+ * - Assets and tilesets are known per index, by the hash of their definition, and of the upload memory
+ *   or asset they were built from, so redefining them from changed data is never dropped.
+ * - Upload memory is known per range, by the hash of what was written there. UploadData copies from
+ *   Apple II memory, which isn't known, so it's always sent and its pages become unknown.
+ * - Anything loaded from a file is known by its filename, so a file changed on disk needs a reset to be reloaded.
+ * Everything is forgotten when GameLink::SDHR_GetStateGeneration() changes, and when a publish fails.
+ * A batch filtered before the failure of an earlier one is known may still rely on it, and is fixed by the next.
+ * Safe to use from any thread.
+*/
+class SDHRResidencyCache
+{
+public:
+	static SDHRResidencyCache& Instance();
+
+	// Walks the batch in order. Each command that would leave the emulator as it is gets false in v_keep,
+	// the effect of the others is recorded. v_keep can be nullptr when everything is sent regardless.
+	void Filter(const uint8_t* data, size_t length, const std::vector<uint32_t>& v_offsets, std::vector<bool>* v_keep);
+
+	// Forgets everything, for when the emulator's state changed behind the batcher's back
+	void Invalidate();
+
+private:
+	SDHRResidencyCache() {};
+
+	// What's known of an asset or tileset index
+	struct Slot
+	{
+		bool known = false;
+		uint64_t content = 0;
+		size_t length = 0;			// bytes hashed into content
+	};
+
+	// What's known of a written range of upload memory
+	struct Range
+	{
+		uint32_t page_count = 0;	// UNKNOWN_EXTENT for files, whose size isn't known here
+		uint64_t content = 0;
+		size_t length = 0;			// bytes hashed into content
+	};
+	static constexpr uint32_t UNKNOWN_EXTENT = 0;
+
+	// Records the command's effect, returns false if it has none
+	bool Apply(SDHR_CMD id, const uint8_t* header, const uint8_t* payload, size_t payload_size);
+
+	// Hash of the pages, false if any of them isn't known
+	bool PagesContent(uint32_t first_page, uint32_t page_count, uint64_t& content) const;
+	// Forgets what's known of the pages, page_count UNKNOWN_EXTENT being up to the end of upload memory
+	void ForgetPages(uint32_t first_page, uint32_t page_count);
+	// Returns false if the range already holds content of that length, and records it otherwise
+	bool WritePages(uint32_t first_page, uint32_t page_count, uint64_t content, size_t length);
+	// Sets the slot, returns false if it already had that content and length
+	static bool SetSlot(Slot& slot, bool known, uint64_t content, size_t length);
+
+	std::mutex lock;				// guards everything below
+	bool invalid = true;
+	uint32_t generation = 0;
+	uint64_t failed_count = 0;		// SDHRSender failures when last filtering
+	Slot assets[256];
+	Slot tilesets[256];
+	std::map<uint32_t, Range> ranges;	// first page -> range, never overlapping
+};
@@ -0,0 +1,172 @@
+#include "SDHRScroller.h"
+#include <cmath>
+
+SDHRScroller::SDHRScroller()
+	: last_update(std::chrono::steady_clock::now())
+{
+}
+
+void SDHRScroller::SetPosition(int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin)
+{
+	View& view = windows[(uint8_t)window_index];
+	view.active = true;
+	view.x = view.target_x = (double)tile_xbegin;
+	view.y = view.target_y = (double)tile_ybegin;
+	view.xspeed = view.yspeed = 0;
+	view.speed = 0;
+	// whoever set the position has also told the window, usually in DefineWindow
+	view.sent_x = tile_xbegin;
+	view.sent_y = tile_ybegin;
+	view.sent = true;
+}
+
+void SDHRScroller::SetVelocity(int8_t window_index, double xspeed, double yspeed)
+{
+	View& view = windows[(uint8_t)window_index];
+	view.active = true;
+	view.xspeed = xspeed;
+	view.yspeed = yspeed;
+	view.target_x = view.x;
+	view.target_y = view.y;
+}
+
+void SDHRScroller::MoveTo(int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin, double speed)
+{
+	View& view = windows[(uint8_t)window_index];
+	view.active = true;
+	view.xspeed = view.yspeed = 0;
+	view.target_x = (double)tile_xbegin;
+	view.target_y = (double)tile_ybegin;
+	view.speed = speed;
+}
+
+void SDHRScroller::MoveBy(int8_t window_index, int64_t xoffset, int64_t yoffset, double speed)
+{
+	View& view = windows[(uint8_t)window_index];
+	if (view.xspeed != 0 || view.yspeed != 0)
+	{
+		view.target_x = view.x;
+		view.target_y = view.y;
+	}
+	MoveTo(window_index, (int64_t)std::llround(view.target_x) + xoffset, (int64_t)std::llround(view.target_y) + yoffset, speed);
+}
+
+void SDHRScroller::Stop(int8_t window_index)
+{
+	View& view = windows[(uint8_t)window_index];
+	view.xspeed = view.yspeed = 0;
+	view.target_x = view.x;
+	view.target_y = view.y;
+}
+
+bool SDHRScroller::IsMoving(int8_t window_index) const
+{
+	const View& view = windows[(uint8_t)window_index];
+	return view.xspeed != 0 || view.yspeed != 0 || view.x != view.target_x || view.y != view.target_y;
+}
+
+void SDHRScroller::Advance(View& view, double seconds)
+{
+	if (view.xspeed != 0 || view.yspeed != 0)
+	{
+		view.x += view.xspeed * seconds;
+		view.y += view.yspeed * seconds;
+		view.target_x = view.x;
+		view.target_y = view.y;
+		return;
+	}
+	const double dx = view.target_x - view.x;
+	const double dy = view.target_y - view.y;
+	const double distance = std::sqrt(dx * dx + dy * dy);
+	const double step = view.speed * seconds;
+	if (distance <= step || view.speed <= 0)
+	{
+		view.x = view.target_x;
+		view.y = view.target_y;
+		return;
+	}
+	view.x += dx * step / distance;
+	view.y += dy * step / distance;
+}
+
+bool SDHRScroller::Update()
+{
+	auto now = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(now - last_update).count();
+	last_update = now;
+	for (View& view : windows)
+	{
+		if (view.active)
+			Advance(view, seconds);
+	}
+
+	if (!GameLink::IsActive())
+		return false;
+	// one view update per emulator frame, and never more than one on its way
+	const uint16_t frame = GameLink::GetFrameSequence();
+	if (published_any && frame == last_frame)
+		return false;
+	if (pending_publish.valid())
+	{
+		if (pending_publish.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+		pending_publish.get();
+	}
+
+	v_changed.clear();
+	for (size_t i = 0; i < 256; i++)
+	{
+		View& view = windows[i];
+		if (!view.active)
+			continue;
+		const int64_t x = (int64_t)std::llround(view.x);
+		const int64_t y = (int64_t)std::llround(view.y);
+		if (view.sent && x == view.sent_x && y == view.sent_y)
+			continue;
+		v_changed.push_back((uint8_t)i);
+		view.sent_x = x;
+		view.sent_y = y;
+		view.sent = true;
+	}
+	if (v_changed.empty())
+		return false;
+
+	if (prepared && v_changed == v_prepared_windows)
+	{
+		// same windows as last time, only their views change
+		for (size_t k = 0; k < v_changed.size(); k++)
+		{
+			const View& view = windows[v_changed[k]];
+			prepared->Set(v_prepared_x[k], view.sent_x);
+			prepared->Set(v_prepared_y[k], view.sent_y);
+		}
+		pending_publish = prepared->Publish();
+		prepared_publish_count++;
+	}
+	else
+	{
+		batcher.Clear();
+		for (uint8_t i : v_changed)
+		{
+			UpdateWindowAdjustWindowViewCmd cmd;
+			cmd.window_index = (int8_t)i;
+			cmd.tile_xbegin = windows[i].sent_x;
+			cmd.tile_ybegin = windows[i].sent_y;
+			batcher.Add(cmd);
+		}
+		prepared.emplace(batcher);
+		v_prepared_windows = v_changed;
+		v_prepared_x.clear();
+		v_prepared_y.clear();
+		for (size_t k = 0; k < v_changed.size(); k++)
+		{
+			v_prepared_x.push_back(SDHR_PREPARED_FIELD(*prepared, k, UpdateWindowAdjustWindowViewCmd, tile_xbegin));
+			v_prepared_y.push_back(SDHR_PREPARED_FIELD(*prepared, k, UpdateWindowAdjustWindowViewCmd, tile_ybegin));
+		}
+		pending_publish = batcher.Publish();
+	}
+	last_frame = frame;
+	published_any = true;
+	publish_count++;
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "SDHRCommand.h"
+#include "SDHRPreparedBatch.h"
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <optional>
+
+/**
+ * @brief SDHRScroller
+ * Owns the tile_xbegin/tile_ybegin view of the windows it's told about, and moves them over time:
+ * at a velocity, or towards a target at a given speed, in pixels per second.
+ * Update() is called once per UI frame. It advances the views by the time elapsed since the last call,
+ * and publishes the views that changed in one UpdateWindowAdjustWindowView batch, at most once per emulator frame.
+ * It never waits on a publish: while the previous one is still on its way, the views keep moving
+ * and the next publish carries where they are by then, so the speed doesn't depend on publish latency.
+ * The batch is encoded once per set of moving windows and kept as an SDHRPreparedBatch; while the same
+ * windows keep moving, each publish only patches their views into it.
+*/
+class SDHRScroller
+{
+public:
+	SDHRScroller();
+
+	// Jumps straight to a view, stopping any movement. Also how a window is put under the scroller's control.
+	void SetPosition(int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin);
+
+	// Moves the view at a constant velocity until Stop() or another request
+	void SetVelocity(int8_t window_index, double xspeed, double yspeed);
+
+	// Moves the view in a straight line to the target, at speed
+	void MoveTo(int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin, double speed);
+
+	// Moves the target of the view by an offset, at speed. Repeated requests add up.
+	void MoveBy(int8_t window_index, int64_t xoffset, int64_t yoffset, double speed);
+
+	// Stops the view where it is now
+	void Stop(int8_t window_index);
+
+	// Advances the views and publishes the ones that changed. Returns true if it published.
+	bool Update();
+
+	int64_t GetX(int8_t window_index) const { return (int64_t)std::llround(windows[(uint8_t)window_index].x); };
+	int64_t GetY(int8_t window_index) const { return (int64_t)std::llround(windows[(uint8_t)window_index].y); };
+	bool IsMoving(int8_t window_index) const;
+
+	uint64_t GetPublishCount() const { return publish_count; };
+	// Publishes that patched the prepared batch instead of encoding a new one
+	uint64_t GetPreparedPublishCount() const { return prepared_publish_count; };
+
+private:
+	struct View
+	{
+		bool active = false;		// set once the window has been given a position
+		double x = 0, y = 0;
+		double target_x = 0, target_y = 0;
+		double xspeed = 0, yspeed = 0;	// velocity mode, when either is non-zero
+		double speed = 0;				// target mode
+		int64_t sent_x = 0, sent_y = 0;	// as last published
+		bool sent = false;
+	};
+
+	// Advances one view by seconds
+	static void Advance(View& view, double seconds);
+
+	View windows[256];
+	std::chrono::steady_clock::time_point last_update;
+	uint16_t last_frame = 0;
+	bool published_any = false;
+	std::future<SDHRPublishStats> pending_publish;
+	uint64_t publish_count = 0;
+	uint64_t prepared_publish_count = 0;
+	SDHRCommandBatcher batcher;
+
+	// The last batch encoded, one UpdateWindowAdjustWindowView per window of v_prepared_windows, in order
+	std::optional<SDHRPreparedBatch> prepared;
+	std::vector<uint8_t> v_prepared_windows;
+	std::vector<SDHRField<int64_t>> v_prepared_x;
+	std::vector<SDHRField<int64_t>> v_prepared_y;
+	std::vector<uint8_t> v_changed;		// scratch, the windows whose views changed
+};
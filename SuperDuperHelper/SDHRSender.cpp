@@ -0,0 +1,327 @@
+#include "SDHRSender.h"
+#include "SDHRDecoder.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+SDHRSender& SDHRSender::Instance()
+{
+	static SDHRSender sender;
+	return sender;
+}
+
+SDHRSender::SDHRSender()
+	: head(&stub), tail(&stub), decode_stats(new SDHRDecodeStats())
+{
+}
+
+SDHRSender::~SDHRSender()
+{
+	Stop();
+}
+
+std::future<SDHRPublishStats> SDHRSender::Submit(const uint8_t* data, size_t length, const std::vector<uint32_t>& offsets,
+	int32_t target_frame)
+{
+	Batch* batch = new Batch();
+	batch->seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+	batch->target_frame = target_frame;
+	batch->v_data.assign(data, data + length);
+	batch->v_offsets = offsets;
+	auto future = batch->done.get_future();
+
+	{
+		// under the lock Stop() holds while the thread drains and exits, so the batch is either pushed
+		// before Stop() starts, and sent, or after it's done, to a new thread
+		std::lock_guard<std::mutex> lock(thread_lock);
+		if (!running.load(std::memory_order_relaxed))
+		{
+			stopping = false;
+			thread = std::thread(&SDHRSender::Run, this);
+			running.store(true, std::memory_order_release);
+		}
+		queued.fetch_add(1, std::memory_order_relaxed);
+		Push(batch);
+	}
+	wakeups.fetch_add(1, std::memory_order_release);
+	wakeups.notify_one();
+	return future;
+}
+
+void SDHRSender::Stop()
+{
+	std::lock_guard<std::mutex> lock(thread_lock);
+	if (!running.load(std::memory_order_relaxed))
+		return;
+	stopping = true;
+	wakeups.fetch_add(1, std::memory_order_release);
+	wakeups.notify_one();
+	thread.join();
+	running.store(false, std::memory_order_release);
+}
+
+SDHRFrameStats SDHRSender::GetFrameStats()
+{
+	std::lock_guard<std::mutex> lock(stats_lock);
+	return frame_stats;
+}
+
+void SDHRSender::ResetFrameStats()
+{
+	std::lock_guard<std::mutex> lock(stats_lock);
+	frame_stats = SDHRFrameStats();
+}
+
+void SDHRSender::GetDecodeStats(SDHRDecodeStats& stats)
+{
+	std::lock_guard<std::mutex> lock(stats_lock);
+	stats = *decode_stats;
+}
+
+void SDHRSender::Push(Batch* batch)
+{
+	batch->next.store(nullptr, std::memory_order_relaxed);
+	Batch* prev = head.exchange(batch, std::memory_order_acq_rel);
+	// between the exchange and this store the queue is briefly unlinked, Pop() then reports it empty
+	prev->next.store(batch, std::memory_order_release);
+}
+
+SDHRSender::Batch* SDHRSender::Pop()
+{
+	Batch* t = tail;
+	Batch* next = t->next.load(std::memory_order_acquire);
+	if (t == &stub)
+	{
+		if (next == nullptr)
+			return nullptr;
+		tail = next;
+		t = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next)
+	{
+		tail = next;
+		return t;
+	}
+	if (t != head.load(std::memory_order_acquire))
+		return nullptr;
+	// t is the last batch: put the stub back behind it so t can be handed out
+	Push(&stub);
+	next = t->next.load(std::memory_order_acquire);
+	if (next)
+	{
+		tail = next;
+		return t;
+	}
+	return nullptr;
+}
+
+void SDHRSender::Run()
+{
+	for (;;)
+	{
+		uint32_t seen = wakeups.load(std::memory_order_acquire);
+		Batch* batch = Pop();
+		if (batch)
+		{
+			if (frame_sync.load(std::memory_order_relaxed) && GameLink::IsActive())
+				Schedule(batch);
+			else if (!v_pending.empty())
+			{
+				// frame sync was just turned off, keep the order
+				v_pending.push_back(batch);
+				ReleaseFrame();
+			}
+			else
+				Finish(batch, Send(*batch));
+			continue;
+		}
+		if (queued.load(std::memory_order_relaxed) != v_pending.size())
+		{
+			// a producer has counted its batch but not linked it yet
+			std::this_thread::yield();
+			continue;
+		}
+		if (!v_pending.empty())
+		{
+			// there's no frame change notification, so poll for it at well under a frame's length
+			if (!ReleaseFrame())
+				std::this_thread::sleep_for(std::chrono::microseconds(500));
+			continue;
+		}
+		if (stopping.load(std::memory_order_acquire))
+			break;
+		wakeups.wait(seen, std::memory_order_acquire);
+	}
+}
+
+void SDHRSender::Finish(Batch* batch, const SDHRPublishStats& stats)
+{
+	if (stats.published)
+		completed.fetch_add(1, std::memory_order_relaxed);
+	else
+		failed.fetch_add(1, std::memory_order_relaxed);
+	batch->done.set_value(stats);
+	delete batch;
+	queued.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void SDHRSender::Schedule(Batch* batch)
+{
+	if (v_pending.empty())
+	{
+		// start watching frames from now
+		last_frame = GameLink::GetFrameSequence();
+		next_free_frame = last_frame + 1;
+	}
+	// frame numbers wrap around, so they're compared by their signed distance
+	if ((int16_t)(next_free_frame - last_frame) <= 0)
+		next_free_frame = last_frame + 1;
+	if (batch->target_frame == NEXT_FRAME)
+		batch->target_frame = next_free_frame++;
+	else
+		batch->target_frame &= 0xFFFF;
+	v_pending.push_back(batch);
+}
+
+bool SDHRSender::ReleaseFrame()
+{
+	if (!frame_sync.load(std::memory_order_relaxed) || !GameLink::IsActive() || stopping.load(std::memory_order_acquire))
+	{
+		// no frames to wait for anymore, or no time to: everything goes out now, in order
+		for (Batch* batch : v_pending)
+			Finish(batch, Send(*batch));
+		v_pending.clear();
+		return true;
+	}
+
+	const uint16_t frame = GameLink::GetFrameSequence();
+	if (frame == last_frame)
+		return false;
+	auto seen = std::chrono::steady_clock::now();
+	const uint16_t advanced = frame - last_frame;
+	last_frame = frame;
+
+	// everything due by this frame goes out as one publish, appended to the first batch in order
+	Batch* first = nullptr;
+	std::vector<Batch*> v_released;
+	size_t kept = 0;
+	for (Batch* batch : v_pending)
+	{
+		if ((int16_t)(frame - (uint16_t)batch->target_frame) < 0)
+		{
+			v_pending[kept++] = batch;
+			continue;
+		}
+		v_released.push_back(batch);
+		if (first == nullptr)
+		{
+			first = batch;
+			continue;
+		}
+		const uint32_t base = (uint32_t)first->v_data.size();
+		for (uint32_t offset : batch->v_offsets)
+			first->v_offsets.push_back(base + offset);
+		first->v_data.insert(first->v_data.end(), batch->v_data.begin(), batch->v_data.end());
+	}
+	v_pending.resize(kept);
+
+	SDHRPublishStats stats;
+	if (first)
+		stats = Send(*first);
+	const double release_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - seen).count();
+	{
+		std::lock_guard<std::mutex> lock(stats_lock);
+		frame_stats.frames_seen++;
+		frame_stats.missed_frames += advanced - 1;
+		if (first)
+		{
+			frame_stats.frames_published++;
+			frame_stats.coalesced += v_released.size() - 1;
+			frame_stats.total_release_seconds += release_seconds;
+			frame_stats.max_release_seconds = std::max(frame_stats.max_release_seconds, release_seconds);
+		}
+		for (Batch* batch : v_released)
+		{
+			if (batch->target_frame != frame)
+				frame_stats.late_publishes++;
+		}
+	}
+
+	for (Batch* batch : v_released)
+	{
+		SDHRPublishStats batch_stats = stats;
+		batch_stats.seq = batch->seq;
+		batch_stats.frame = frame;
+		batch_stats.frames_late = (uint16_t)(frame - (uint16_t)batch->target_frame);
+		batch_stats.coalesced = v_released.size();
+		Finish(batch, batch_stats);
+	}
+	return true;
+}
+
+SDHRPublishStats SDHRSender::Send(const Batch& batch)
+{
+	if (validate.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(stats_lock);
+		if (!decode_stats->Add(batch.v_data.data(), batch.v_data.size()))
+		{
+			OutputDebugStringW(L"ERROR: SDHR batch doesn't decode, not publishing it!\n");
+			SDHRPublishStats stats;
+			stats.seq = batch.seq;
+			return stats;
+		}
+	}
+	SDHRPublishStats stats = Write(batch.v_data.data(), batch.v_data.size(), batch.v_offsets);
+	stats.seq = batch.seq;
+	return stats;
+}
+
+SDHRPublishStats SDHRSender::Write(const uint8_t* data, size_t length, const std::vector<uint32_t>& offsets)
+{
+	auto start = std::chrono::steady_clock::now();
+	SDHRPublishStats stats;
+	if (!GameLink::IsActive())
+		return stats;
+
+	const size_t max_chunk = GameLink::SDHR_GetMaxWriteLength();
+	stats.published = true;
+	stats.result = GameLink::WriteResult::OK;
+	size_t chunk_begin = 0;
+	size_t next_cmd = 0;
+	do
+	{
+		// grow the chunk one whole command at a time, for as long as it fits in SHM
+		size_t chunk_end = chunk_begin;
+		while (next_cmd < offsets.size())
+		{
+			size_t cmd_end = (next_cmd + 1 < offsets.size()) ? offsets[next_cmd + 1] : length;
+			if (cmd_end - chunk_begin > max_chunk)
+				break;
+			chunk_end = cmd_end;
+			++next_cmd;
+		}
+		if (chunk_end == chunk_begin && next_cmd < offsets.size())
+		{
+			OutputDebugStringW(L"ERROR: SDHR command is larger than the SHM buffer, can't publish it!\n");
+			stats.result = GameLink::WriteResult::TOO_LARGE;
+			stats.published = false;
+			break;
+		}
+		stats.result = GameLink::SDHR_write(data + chunk_begin, chunk_end - chunk_begin);
+		if (stats.result == GameLink::WriteResult::OK)
+			stats.result = GameLink::SendCommand(std::string(":sdhr_process"));
+		if (stats.result != GameLink::WriteResult::OK)
+		{
+			stats.published = false;
+			break;
+		}
+		stats.bytes += chunk_end - chunk_begin;
+		stats.chunks++;
+		chunk_begin = chunk_end;
+	} while (chunk_begin < length);
+	stats.commands = next_cmd;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
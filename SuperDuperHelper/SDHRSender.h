@@ -0,0 +1,152 @@
+#pragma once
+#include "GameLink.h"
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SDHRDecodeStats;	// SDHRDecoder.h
+
+/**
+ * @brief SDHRPublishStats
+ * Outcome of one published batch: what was sent, and how fast
+*/
+struct SDHRPublishStats
+{
+	uint64_t seq = 0;		// submission sequence number of the batch
+	bool published = false;	// false if any part of the batch could not be written to SHM
+	GameLink::WriteResult result = GameLink::WriteResult::NOT_ACTIVE;	// of the last write tried, NOT_ACTIVE if none was
+	size_t bytes = 0;		// encoded command bytes written to SHM
+	size_t chunks = 0;		// number of :sdhr_write/:sdhr_process round trips
+	size_t commands = 0;
+	double seconds = 0;		// time from the first write to the last process, waiting included
+	uint16_t frame = 0;		// in frame sync mode, the emulator frame the batch was released on
+	uint16_t frames_late = 0;	// in frame sync mode, how many frames after its target frame it was released
+	size_t coalesced = 1;	// batches that went out together in the same publish, this one included
+
+	double MegabytesPerSecond() const { return (seconds > 0) ? (bytes / seconds / (1024.0 * 1024.0)) : 0; };
+};
+
+/**
+ * @brief SDHRFrameStats
+ * How well frame sync mode kept up with the emulator's frames
+*/
+struct SDHRFrameStats
+{
+	uint64_t frames_seen = 0;		// frame changes seen while batches were waiting for their frame
+	uint64_t frames_published = 0;	// frames on which a publish was released
+	uint64_t missed_frames = 0;		// frames that went by unseen between two looks at the frame sequence
+	uint64_t late_publishes = 0;	// batches released on a later frame than the one they targeted
+	uint64_t coalesced = 0;			// batches that went out in the same publish as an earlier one
+	double max_release_seconds = 0;	// longest time from seeing a frame change to its publish being processed
+	double total_release_seconds = 0;
+
+	double MeanReleaseSeconds() const { return frames_published ? (total_release_seconds / frames_published) : 0; };
+};
+
+/**
+ * @brief SDHRSender
+ * The one owner of the SDHR side of the GameLink SHM handshake.
+ * Any number of threads submit encoded batches, which go through an intrusive MPSC queue, walked without locking
+ * by a single sender thread that writes them to SHM in queue order.
+ * Submitting only waits on a Stop() in progress; the returned future completes once the batch has been processed or has failed.
+ * In frame sync mode the sender thread holds batches back and releases them on emulator frame changes,
+ * as seen through GameLink::GetFrameSequence(): one publish per frame at most. Batches without a target frame
+ * take the following frames one each, in order. Batches that target the same frame are coalesced into one publish.
+*/
+class SDHRSender
+{
+public:
+	static SDHRSender& Instance();
+
+	// Target frame of a batch that should go out on the next frame not already taken by another batch
+	static constexpr int32_t NEXT_FRAME = -1;
+
+	~SDHRSender();
+
+	// Queues a copy of an encoded batch. offsets holds the offset of each command's size header.
+	// Starts the sender thread if it isn't running.
+	// target_frame is the GameLink::GetFrameSequence() value to release the batch on, in frame sync mode.
+	std::future<SDHRPublishStats> Submit(const uint8_t* data, size_t length, const std::vector<uint32_t>& offsets,
+		int32_t target_frame = NEXT_FRAME);
+
+	// Switches frame sync mode. Batches waiting for their frame go out at once when it's turned off.
+	void SetFrameSync(bool enable) { frame_sync.store(enable, std::memory_order_relaxed); };
+	bool IsFrameSync() const { return frame_sync.load(std::memory_order_relaxed); };
+	SDHRFrameStats GetFrameStats();
+	void ResetFrameStats();
+
+	// With validation on, every batch is decoded before it's sent and accounted for in the decode stats.
+	// A batch that doesn't decode fails instead of being sent.
+	void SetValidate(bool enable) { validate.store(enable, std::memory_order_relaxed); };
+	bool IsValidate() const { return validate.load(std::memory_order_relaxed); };
+	void GetDecodeStats(SDHRDecodeStats& stats);
+
+	// Writes an encoded batch to SHM right away on the calling thread, bypassing the queue,
+	// in chunks cut at command boundaries, each followed by :sdhr_process
+	static SDHRPublishStats Write(const uint8_t* data, size_t length, const std::vector<uint32_t>& offsets);
+
+	// Stops the sender thread once the batches already queued have been sent.
+	// Batches submitted meanwhile wait for it, then start a new thread.
+	void Stop();
+
+	// Batches submitted but not yet completed
+	size_t GetQueueDepth() const { return queued.load(std::memory_order_relaxed); };
+	uint64_t GetCompletedCount() const { return completed.load(std::memory_order_relaxed); };
+	uint64_t GetFailedCount() const { return failed.load(std::memory_order_relaxed); };
+
+private:
+	struct Batch
+	{
+		std::atomic<Batch*> next = nullptr;
+		uint64_t seq = 0;
+		int32_t target_frame = NEXT_FRAME;
+		std::vector<uint8_t> v_data;
+		std::vector<uint32_t> v_offsets;
+		std::promise<SDHRPublishStats> done;
+	};
+
+	SDHRSender();
+
+	// Vyukov's intrusive MPSC queue: producers only swap the head, the sender thread alone walks the tail
+	void Push(Batch* batch);
+	Batch* Pop();
+
+	void Run();
+
+	// Write()s the batch
+	SDHRPublishStats Send(const Batch& batch);
+
+	// Hands the outcome to the batch's future and frees it
+	void Finish(Batch* batch, const SDHRPublishStats& stats);
+
+	// Frame sync mode, sender thread only: Schedule() gives a batch its target frame and holds it in v_pending,
+	// ReleaseFrame() sends what's due if the frame changed. It returns false if there was nothing to do yet.
+	void Schedule(Batch* batch);
+	bool ReleaseFrame();
+
+	std::atomic<Batch*> head;
+	Batch* tail;
+	Batch stub;
+
+	std::atomic<uint32_t> queued = 0;		// counted before the push, so a batch is never completed before it's counted
+	std::atomic<uint32_t> wakeups = 0;		// bumped after each push and on Stop(), the sender thread waits on it when idle
+	std::atomic<uint64_t> next_seq = 1;
+	std::atomic<uint64_t> completed = 0;
+	std::atomic<uint64_t> failed = 0;
+	std::atomic<bool> running = false;
+	std::atomic<bool> stopping = false;
+	std::thread thread;
+	std::mutex thread_lock;	// guards starting and stopping the thread, and pushing batches
+
+	std::atomic<bool> frame_sync = false;
+	std::vector<Batch*> v_pending;		// scheduled batches in submission order, waiting for their frame
+	uint16_t last_frame = 0;			// frame sequence as last seen
+	uint16_t next_free_frame = 0;		// first frame not taken yet by a batch without a target
+	SDHRFrameStats frame_stats;
+	std::atomic<bool> validate = false;
+	std::unique_ptr<SDHRDecodeStats> decode_stats;
+	std::mutex stats_lock;				// guards frame_stats and decode_stats
+};
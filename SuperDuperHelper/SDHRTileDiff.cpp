@@ -0,0 +1,167 @@
+#include "SDHRTileDiff.h"
+#include <bit>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SDHR_TILEDIFF_SSE2
+#endif
+
+// Wire cost of a SetBoth update: size header, id byte and fixed header, then the tiles
+constexpr size_t SET_BOTH_HEADER = 2 + 1 + SDHRCommandLayout<UpdateWindowSetBothCmd>::fixed_size;
+
+// Unchanged tiles are worth resending to close a gap up to this wide, rather than starting another command
+constexpr uint32_t MAX_RUN_GAP = SET_BOTH_HEADER / 2;
+
+static size_t RectCost(const SDHRTileRect& r)
+{
+	return SET_BOTH_HEADER + (size_t)r.xcount * r.ycount * 2;
+}
+
+size_t SDHRTileDiff::DiffRow(const uint8_t* prev, const uint8_t* next, uint32_t xcount, uint64_t* dirty)
+{
+	size_t changed = 0;
+	uint32_t x = 0;
+#if defined(__AVX2__)
+	for (; x + 16 <= xcount; x += 16)
+	{
+		__m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(prev + x * 2)),
+			_mm256_loadu_si256((const __m256i*)(next + x * 2)));
+		// narrow the 16-bit lanes to one byte per tile, then one bit per tile
+		__m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(eq), _mm256_extracti128_si256(eq, 1));
+		uint64_t mask = (uint16_t)~_mm_movemask_epi8(packed);
+		dirty[x / 64] |= mask << (x % 64);
+		changed += std::popcount(mask);
+	}
+#elif defined(SDHR_TILEDIFF_SSE2)
+	for (; x + 8 <= xcount; x += 8)
+	{
+		__m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(prev + x * 2)),
+			_mm_loadu_si128((const __m128i*)(next + x * 2)));
+		// narrow the 16-bit lanes to one byte per tile, then one bit per tile
+		uint64_t mask = (uint8_t)~_mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+		dirty[x / 64] |= mask << (x % 64);
+		changed += std::popcount(mask);
+	}
+#endif
+	for (; x < xcount; x++)
+	{
+		if (prev[x * 2] != next[x * 2] || prev[x * 2 + 1] != next[x * 2 + 1])
+		{
+			dirty[x / 64] |= (uint64_t)1 << (x % 64);
+			changed++;
+		}
+	}
+	return changed;
+}
+
+void SDHRTileDiff::Diff(const uint8_t* prev, const uint8_t* next, uint32_t xcount, uint32_t ycount, std::vector<SDHRTileRect>& rects)
+{
+	rects.clear();
+	const size_t words = (xcount + 63) / 64;
+	std::vector<uint64_t> dirty(words);
+	std::vector<SDHRTileRect> open;		// rects still growing downwards, all ending on the previous row
+	std::vector<SDHRTileRect> still_open;
+	const size_t row_bytes = (size_t)xcount * 2;
+
+	for (uint32_t y = 0; y < ycount; y++)
+	{
+		std::fill(dirty.begin(), dirty.end(), 0);
+		size_t changed = DiffRow(prev + y * row_bytes, next + y * row_bytes, xcount, dirty.data());
+
+		still_open.clear();
+		if (changed)
+		{
+			// walk the runs of changed tiles, bridging short gaps
+			uint32_t run_begin = 0, run_end = 0;
+			bool in_run = false;
+			for (size_t w = 0; w < words; w++)
+			{
+				uint64_t bits = dirty[w];
+				while (bits)
+				{
+					uint32_t x = (uint32_t)(w * 64) + std::countr_zero(bits);
+					bits &= bits - 1;
+					if (in_run && x - run_end <= MAX_RUN_GAP)
+					{
+						run_end = x + 1;
+						continue;
+					}
+					if (in_run)
+						still_open.push_back({ run_begin, y, run_end - run_begin, 1 });
+					run_begin = x;
+					run_end = x + 1;
+					in_run = true;
+				}
+			}
+			if (in_run)
+				still_open.push_back({ run_begin, y, run_end - run_begin, 1 });
+		}
+
+		// A run takes over the rects ending on the row above that it touches, when their bounding box
+		// costs no more than keeping them apart. Rects that nothing took over are done.
+		for (auto& run : still_open)
+		{
+			for (auto& r : open)
+			{
+				if (r.xcount == 0 || r.x > run.x + run.xcount || run.x > r.x + r.xcount)
+					continue;
+				const uint32_t x0 = std::min(r.x, run.x);
+				const uint32_t y0 = std::min(r.y, run.y);
+				const uint32_t x1 = std::max(r.x + r.xcount, run.x + run.xcount);
+				const SDHRTileRect box = { x0, y0, x1 - x0, y + 1 - y0 };
+				if (RectCost(box) <= RectCost(r) + RectCost(run))
+				{
+					run = box;
+					r.xcount = 0;	// taken over by the run
+				}
+			}
+		}
+		for (auto& r : open)
+		{
+			if (r.xcount != 0)
+				rects.push_back(r);
+		}
+		open.swap(still_open);
+	}
+	rects.insert(rects.end(), open.begin(), open.end());
+}
+
+SDHRTileDiffStats SDHRTileDiff::Encode(SDHRCommandBatcher& batcher, int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin,
+	const uint8_t* prev, const uint8_t* next, uint32_t xcount, uint32_t ycount)
+{
+	SDHRTileDiffStats stats;
+	stats.full_bytes = SET_BOTH_HEADER + (size_t)xcount * ycount * 2;
+	const size_t start_size = batcher.Size();
+
+	std::vector<SDHRTileRect> rects;
+	Diff(prev, next, xcount, ycount, rects);
+	stats.rects = rects.size();
+
+	std::vector<uint8_t> v_data;
+	const size_t row_bytes = (size_t)xcount * 2;
+	for (auto& r : rects)
+	{
+		const size_t tiles = (size_t)r.xcount * r.ycount;
+		const uint8_t* origin = next + r.y * row_bytes + (size_t)r.x * 2;
+		for (uint32_t y = 0; y < r.ycount; y++)
+		{
+			uint32_t changed = 0;
+			const uint8_t* row = prev + (r.y + y) * row_bytes + (size_t)r.x * 2;
+			const uint8_t* nrow = origin + y * row_bytes;
+			for (uint32_t x = 0; x < r.xcount; x++)
+				changed += (row[x * 2] != nrow[x * 2] || row[x * 2 + 1] != nrow[x * 2 + 1]);
+			stats.changed_tiles += changed;
+		}
+
+		v_data.resize(tiles * 2);
+		for (uint32_t y = 0; y < r.ycount; y++)
+			memcpy(v_data.data() + (size_t)y * r.xcount * 2, origin + y * row_bytes, (size_t)r.xcount * 2);
+		SDHRSetTilesStats set = batcher.SetTiles(window_index, tile_xbegin + r.x, tile_ybegin + r.y, r.xcount, r.ycount, v_data.data());
+		if (set.single_tileset_commands > 0 && set.set_both_commands == 0)
+			stats.single_tileset_rects++;
+	}
+	stats.bytes = batcher.Size() - start_size;
+	return stats;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "SDHRCommand.h"
+#include <vector>
+
+/**
+ * @brief SDHRTileDiff
+ * Turns a change to a window's tile array into the few tile updates that cover it,
+ * instead of resending the whole region.
+ * Tile arrays are row-major, 2 bytes per tile (tileset, index), the same layout UpdateWindowSetBoth uses.
+ * Rows are compared with AVX2 or SSE2 when the build targets them, one tile at a time otherwise.
+*/
+
+struct SDHRTileRect
+{
+	uint32_t x, y;			// first tile
+	uint32_t xcount, ycount;
+};
+
+struct SDHRTileDiffStats
+{
+	size_t changed_tiles = 0;
+	size_t rects = 0;
+	size_t single_tileset_rects = 0;	// rects sent as UpdateWindowSingleTileset instead of UpdateWindowSetBoth
+	size_t bytes = 0;					// encoded bytes added to the batch
+	size_t full_bytes = 0;				// what one UpdateWindowSetBoth of the whole array would have cost
+};
+
+class SDHRTileDiff
+{
+public:
+	// Finds the rectangles covering every tile that differs between prev and next.
+	// Nearby changes are clustered into one rectangle when resending the unchanged tiles between them
+	// costs less than the header of another command.
+	static void Diff(const uint8_t* prev, const uint8_t* next, uint32_t xcount, uint32_t ycount, std::vector<SDHRTileRect>& rects);
+
+	// Adds to the batch the updates that turn window_index's tiles from prev into next,
+	// each rectangle encoded by SDHRCommandBatcher::SetTiles().
+	// tile_xbegin/ybegin is where the arrays sit in the window's backing tile array.
+	static SDHRTileDiffStats Encode(SDHRCommandBatcher& batcher, int8_t window_index, int64_t tile_xbegin, int64_t tile_ybegin,
+		const uint8_t* prev, const uint8_t* next, uint32_t xcount, uint32_t ycount);
+
+private:
+	// Sets one bit per changed tile of the row in dirty, 64 tiles per word
+	static size_t DiffRow(const uint8_t* prev, const uint8_t* next, uint32_t xcount, uint64_t* dirty);
+};
@@ -0,0 +1,305 @@
+#include "SDHRTrace.h"
+#include "SDHRResidencyCache.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+static const char g_trace_magic[8] = { 'S', 'D', 'H', 'R', 'T', 'R', 'C', '1' };
+
+static uint64_t Align8(uint64_t value)
+{
+	return (value + 7) & ~(uint64_t)7;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Recorder
+//////////////////////////////////////////////////////////////////////////
+
+SDHRTraceRecorder& SDHRTraceRecorder::Instance()
+{
+	static SDHRTraceRecorder recorder;
+	return recorder;
+}
+
+SDHRTraceRecorder::~SDHRTraceRecorder()
+{
+	Stop();
+}
+
+bool SDHRTraceRecorder::Start(const std::string& path)
+{
+	Stop();
+	std::lock_guard<std::mutex> guard(lock);
+	file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+	SDHRTraceHeader header = {};
+	memcpy(header.magic, g_trace_magic, sizeof(header.magic));
+	header.version = SDHR_TRACE_VERSION;
+	file.write((const char*)&header, sizeof(header));
+	offset = sizeof(header);
+	v_index.clear();
+	start = std::chrono::steady_clock::now();
+	recording.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+void SDHRTraceRecorder::Stop()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file.is_open())
+		return;
+	recording.store(false, std::memory_order_relaxed);
+	file.write((const char*)v_index.data(), v_index.size() * sizeof(uint64_t));
+	SDHRTraceHeader header = {};
+	memcpy(header.magic, g_trace_magic, sizeof(header.magic));
+	header.version = SDHR_TRACE_VERSION;
+	header.record_count = (uint32_t)v_index.size();
+	header.index_offset = offset;
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	file.close();
+}
+
+void SDHRTraceRecorder::Append(const uint8_t* data, size_t length, size_t command_count)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file.is_open())
+		return;
+	SDHRTraceRecord record = {};
+	record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	record.length = (uint32_t)length;
+	record.command_count = (uint32_t)command_count;
+	record.frame = GameLink::IsActive() ? GameLink::GetFrameSequence() : 0;
+	file.write((const char*)&record, sizeof(record));
+	file.write((const char*)data, length);
+	static const char padding[8] = {};
+	const uint64_t end = Align8(offset + sizeof(record) + length);
+	file.write(padding, end - (offset + sizeof(record) + length));
+	v_index.push_back(offset);
+	offset = end;
+}
+
+size_t SDHRTraceRecorder::GetRecordCount()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return v_index.size();
+}
+
+uint64_t SDHRTraceRecorder::GetBytes()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return offset;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Trace
+//////////////////////////////////////////////////////////////////////////
+
+bool SDHRTrace::Load(const std::string& path)
+{
+	v_file.clear();
+	v_index.clear();
+	std::ifstream f(path, std::ios::in | std::ios::binary);
+	if (!f.is_open())
+		return false;
+	v_file.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+	SDHRTraceHeader header;
+	if (v_file.size() < sizeof(header))
+		return false;
+	memcpy(&header, v_file.data(), sizeof(header));
+	if (memcmp(header.magic, g_trace_magic, sizeof(header.magic)) != 0 || header.version != SDHR_TRACE_VERSION)
+		return false;
+
+	const uint64_t size = v_file.size();
+	if (header.index_offset != 0 && header.index_offset <= size
+		&& (size - header.index_offset) / sizeof(uint64_t) >= header.record_count)
+	{
+		v_index.resize(header.record_count);
+		memcpy(v_index.data(), v_file.data() + header.index_offset, header.record_count * sizeof(uint64_t));
+		// an index that points outside the records is as good as none
+		bool valid = true;
+		for (uint64_t offset : v_index)
+		{
+			SDHRTraceRecord record;
+			if (offset < sizeof(header) || offset + sizeof(record) > header.index_offset)
+			{
+				valid = false;
+				break;
+			}
+			memcpy(&record, v_file.data() + offset, sizeof(record));
+			if (offset + sizeof(record) + record.length > header.index_offset)
+			{
+				valid = false;
+				break;
+			}
+		}
+		if (valid)
+			return true;
+		v_index.clear();
+	}
+
+	// no index: walk the records up to the last complete one
+	uint64_t offset = sizeof(header);
+	while (offset + sizeof(SDHRTraceRecord) <= size)
+	{
+		SDHRTraceRecord record;
+		memcpy(&record, v_file.data() + offset, sizeof(record));
+		if (offset + sizeof(record) + record.length > size)
+			break;
+		v_index.push_back(offset);
+		offset = Align8(offset + sizeof(record) + record.length);
+	}
+	return true;
+}
+
+SDHRTrace::Entry SDHRTrace::Get(size_t i) const
+{
+	SDHRTraceRecord record;
+	memcpy(&record, v_file.data() + v_index[i], sizeof(record));
+	Entry entry;
+	entry.timestamp_ns = record.timestamp_ns;
+	entry.frame = record.frame;
+	entry.data = v_file.data() + v_index[i] + sizeof(record);
+	entry.length = record.length;
+	entry.command_count = record.command_count;
+	return entry;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Replayer
+//////////////////////////////////////////////////////////////////////////
+
+SDHRTraceReplayer::~SDHRTraceReplayer()
+{
+	Stop();
+}
+
+bool SDHRTraceReplayer::Start(const std::string& path, SDHRReplayMode mode)
+{
+	if (running.load(std::memory_order_relaxed))
+		return false;
+	if (thread.joinable())
+		thread.join();
+	if (!trace.Load(path))
+		return false;
+	record_count = trace.Count();
+	{
+		std::lock_guard<std::mutex> guard(stats_lock);
+		stats = SDHRReplayStats();
+	}
+	cancel = false;
+	running = true;
+	thread = std::thread(&SDHRTraceReplayer::Run, this, mode);
+	return true;
+}
+
+void SDHRTraceReplayer::Stop()
+{
+	cancel = true;
+	if (thread.joinable())
+		thread.join();
+}
+
+SDHRReplayStats SDHRTraceReplayer::GetStats()
+{
+	std::lock_guard<std::mutex> guard(stats_lock);
+	return stats;
+}
+
+bool SDHRTraceReplayer::WaitUntil(std::chrono::steady_clock::time_point when)
+{
+	while (!cancel.load(std::memory_order_relaxed))
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (now >= when)
+			return true;
+		std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(when - now, std::chrono::milliseconds(10)));
+	}
+	return false;
+}
+
+bool SDHRTraceReplayer::WaitFrames(uint64_t frames)
+{
+	while (!cancel.load(std::memory_order_relaxed))
+	{
+		if (!GameLink::IsActive())
+			return true;	// the write will fail and be counted
+		const uint16_t frame = GameLink::GetFrameSequence();
+		frames_passed += (uint16_t)(frame - last_frame);
+		last_frame = frame;
+		if (frames_passed >= frames)
+			return true;
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+	return false;
+}
+
+void SDHRTraceReplayer::Run(SDHRReplayMode mode)
+{
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<uint32_t> v_offsets;
+	uint64_t first_timestamp = 0;
+	uint16_t recorded_frame = 0;
+	uint64_t recorded_frames = 0;
+	last_frame = GameLink::IsActive() ? GameLink::GetFrameSequence() : 0;
+	frames_passed = 0;
+
+	for (size_t i = 0; i < trace.Count(); i++)
+	{
+		const SDHRTrace::Entry entry = trace.Get(i);
+		if (i == 0)
+		{
+			first_timestamp = entry.timestamp_ns;
+			recorded_frame = entry.frame;
+		}
+		// frame numbers wrap, so the recorded distance is summed up from record to record
+		recorded_frames += (uint16_t)(entry.frame - recorded_frame);
+		recorded_frame = entry.frame;
+
+		const auto due = start + std::chrono::nanoseconds(entry.timestamp_ns - first_timestamp);
+		bool waited = true;
+		if (mode == SDHRReplayMode::ORIGINAL_TIMING)
+			waited = WaitUntil(due);
+		else if (mode == SDHRReplayMode::FRAME_LOCKED)
+			waited = WaitFrames(recorded_frames);
+		if (!waited)
+			break;
+
+		// find the commands again from their size headers
+		v_offsets.clear();
+		size_t offset = 0;
+		while (offset + 3 <= entry.length)
+		{
+			uint16_t size;
+			memcpy(&size, entry.data + offset, 2);
+			v_offsets.push_back((uint32_t)offset);
+			offset += 3 + size;
+		}
+		const bool well_formed = (offset == entry.length);
+
+		// the replay changes the emulator's state behind the batchers' back
+		SDHRResidencyCache::Instance().Invalidate();
+		const auto write_start = std::chrono::steady_clock::now();
+		SDHRPublishStats written;
+		if (well_formed)
+			written = SDHRSender::Write(entry.data, entry.length, v_offsets);
+		const auto write_end = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> guard(stats_lock);
+		stats.records++;
+		if (!written.published)
+			stats.failed++;
+		stats.bytes += written.bytes;
+		stats.chunks += written.chunks;
+		const double write_seconds = std::chrono::duration<double>(write_end - write_start).count();
+		stats.total_write_seconds += write_seconds;
+		stats.min_write_seconds = (stats.records == 1) ? write_seconds : std::min(stats.min_write_seconds, write_seconds);
+		stats.max_write_seconds = std::max(stats.max_write_seconds, write_seconds);
+		if (mode == SDHRReplayMode::ORIGINAL_TIMING)
+			stats.max_late_seconds = std::max(stats.max_late_seconds, std::chrono::duration<double>(write_start - due).count());
+		stats.seconds = std::chrono::duration<double>(write_end - start).count();
+	}
+	running = false;
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include "SDHRSender.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief SDHR trace files
+ * A trace holds every batch published during a session, in order, so the session can be replayed
+ * without the game that produced it.
+ * The layout is little endian and 8-byte aligned throughout, so a mapped file can be read in place:
+ *   SDHRTraceHeader
+ *   records, each a SDHRTraceRecord followed by the encoded batch, padded to 8 bytes
+ *   the index, one uint64_t file offset per record
+ * index_offset and record_count are filled in when the recording stops. A trace that wasn't stopped
+ * cleanly has neither, and is read by walking its records instead.
+*/
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct SDHRTraceHeader
+{
+	char magic[8];				// "SDHRTRC1"
+	uint32_t version;
+	uint32_t record_count;
+	uint64_t index_offset;		// 0 if the trace wasn't closed
+	uint64_t reserved;
+};
+
+struct SDHRTraceRecord
+{
+	uint64_t timestamp_ns;		// since the recording started
+	uint32_t length;			// bytes of encoded batch following the record
+	uint32_t command_count;
+	uint16_t frame;				// GameLink::GetFrameSequence() when the batch was published
+	uint16_t reserved16;
+	uint32_t reserved32;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(SDHRTraceHeader) % 8 == 0 && sizeof(SDHRTraceRecord) % 8 == 0, "trace structs must keep records aligned");
+
+constexpr uint32_t SDHR_TRACE_VERSION = 1;
+
+/**
+ * @brief SDHRTraceRecorder
+ * Appends every batch SDHRCommandBatcher::Publish() hands over to a trace file, while recording.
+ * Safe to use from any thread.
+*/
+class SDHRTraceRecorder
+{
+public:
+	static SDHRTraceRecorder& Instance();
+
+	~SDHRTraceRecorder();
+
+	// Starts a new trace, replacing the file. Returns false if it can't be created.
+	bool Start(const std::string& path);
+	// Writes the index and closes the trace
+	void Stop();
+	bool IsRecording() const { return recording.load(std::memory_order_relaxed); };
+
+	void Append(const uint8_t* data, size_t length, size_t command_count);
+
+	size_t GetRecordCount();
+	uint64_t GetBytes();
+
+private:
+	SDHRTraceRecorder() {};
+
+	std::atomic<bool> recording = false;
+	std::mutex lock;				// guards everything below
+	std::ofstream file;
+	uint64_t offset = 0;			// where the next record goes
+	std::vector<uint64_t> v_index;
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * @brief SDHRTrace
+ * A trace file loaded in memory
+*/
+class SDHRTrace
+{
+public:
+	struct Entry
+	{
+		uint64_t timestamp_ns;
+		uint16_t frame;
+		const uint8_t* data;
+		uint32_t length;
+		uint32_t command_count;
+	};
+
+	// Returns false if the file can't be read or isn't a trace. A trace cut short keeps its complete records.
+	bool Load(const std::string& path);
+
+	size_t Count() const { return v_index.size(); };
+	Entry Get(size_t i) const;
+
+private:
+	std::vector<uint8_t> v_file;
+	std::vector<uint64_t> v_index;
+};
+
+enum class SDHRReplayMode
+{
+	ORIGINAL_TIMING,		// each batch is written as long after the first as it was recorded
+	AS_FAST_AS_POSSIBLE,	// back to back
+	FRAME_LOCKED,			// each batch is written as many emulator frames after the first as it was recorded
+};
+
+struct SDHRReplayStats
+{
+	size_t records = 0;				// batches replayed so far
+	size_t failed = 0;				// batches that couldn't be written, or were malformed
+	size_t bytes = 0;
+	size_t chunks = 0;
+	double seconds = 0;				// since the replay started
+	double total_write_seconds = 0;	// time spent in writes, waiting for SHM included
+	double min_write_seconds = 0;
+	double max_write_seconds = 0;
+	double max_late_seconds = 0;	// in ORIGINAL_TIMING, the most a batch went out after its time
+
+	double MegabytesPerSecond() const { return (total_write_seconds > 0) ? (bytes / total_write_seconds / (1024.0 * 1024.0)) : 0; };
+	double MeanWriteSeconds() const { return records ? (total_write_seconds / records) : 0; };
+};
+
+/**
+ * @brief SDHRTraceReplayer
+ * Feeds a trace back to GameLink::SDHR_write on its own thread, bypassing the SDHRSender queue
+ * so that what's measured is SHM and the emulator alone.
+*/
+class SDHRTraceReplayer
+{
+public:
+	~SDHRTraceReplayer();
+
+	// Loads the trace and starts replaying it. Returns false if it can't be loaded, or a replay is running.
+	bool Start(const std::string& path, SDHRReplayMode mode);
+	// Cancels the replay, and waits for the batch being written
+	void Stop();
+	bool IsRunning() const { return running.load(std::memory_order_relaxed); };
+
+	SDHRReplayStats GetStats();
+	size_t GetRecordCount() const { return record_count; };
+
+private:
+	void Run(SDHRReplayMode mode);
+
+	// Sleeps in short steps until the time or the cancel, returns false if cancelled
+	bool WaitUntil(std::chrono::steady_clock::time_point when);
+	// Polls the emulator's frames until frames have gone by since the replay started, returns false if cancelled
+	bool WaitFrames(uint64_t frames);
+
+	SDHRTrace trace;
+	size_t record_count = 0;
+	std::thread thread;
+	std::atomic<bool> running = false;
+	std::atomic<bool> cancel = false;
+	uint16_t last_frame = 0;
+	uint64_t frames_passed = 0;
+	SDHRReplayStats stats;
+	std::mutex stats_lock;			// guards stats
+};
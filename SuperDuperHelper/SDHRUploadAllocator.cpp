@@ -0,0 +1,160 @@
+#include "SDHRUploadAllocator.h"
+#include <algorithm>
+#include <iterator>
+
+SDHRUploadAllocator::SDHRUploadAllocator(uint32_t page_count)
+	: total_pages(page_count)
+{
+	Reset();
+}
+
+const SDHRUploadRegion* SDHRUploadAllocator::Allocate(const std::string& name, size_t length)
+{
+	const size_t pages = (length + SDHR_UPLOAD_PAGE_SIZE - 1) / SDHR_UPLOAD_PAGE_SIZE;
+	if (pages == 0 || pages > total_pages)
+	{
+		OutputDebugStringW(L"ERROR: SDHR upload region size is out of range!\n");
+		return nullptr;
+	}
+	auto it = regions.find(name);
+	if (it != regions.end())
+	{
+		if (it->second.page_count >= pages)
+			return &it->second;
+		Free(name);
+	}
+	uint32_t first_page;
+	if (!TakePages((uint32_t)pages, first_page))
+	{
+		OutputDebugStringW(L"ERROR: SDHR upload memory is full!\n");
+		return nullptr;
+	}
+	SDHRUploadRegion& region = regions[name];
+	region = SDHRUploadRegion();
+	region.first_page = first_page;
+	region.page_count = (uint32_t)pages;
+	return &region;
+}
+
+void SDHRUploadAllocator::Free(const std::string& name)
+{
+	auto it = regions.find(name);
+	if (it == regions.end())
+		return;
+	ReturnPages(it->second.first_page, it->second.page_count);
+	regions.erase(it);
+}
+
+const SDHRUploadRegion* SDHRUploadAllocator::Find(const std::string& name) const
+{
+	auto it = regions.find(name);
+	return (it != regions.end()) ? &it->second : nullptr;
+}
+
+const SDHRUploadRegion* SDHRUploadAllocator::Upload(SDHRCommandBatcher& batcher, const std::string& name, const uint8_t* data, size_t length)
+{
+	const SDHRUploadRegion* region = Allocate(name, length);
+	if (region == nullptr)
+		return nullptr;
+	const uint64_t content = SDHRHash(data, length);
+	if (IsResident(name, content, length))
+	{
+		uploads_skipped++;
+		bytes_skipped += length;
+		return region;
+	}
+	if (!batcher.AddUpload(region->Address(), data, length))
+		return nullptr;
+	uploads++;
+	bytes_uploaded += length;
+	batcher.SetResidentOnPublish(this, name, region->first_page, content, length);
+	return region;
+}
+
+bool SDHRUploadAllocator::IsResident(const std::string& name, uint64_t content, size_t length) const
+{
+	const SDHRUploadRegion* region = Find(name);
+	return region != nullptr && region->resident && region->content == content && region->length == length
+		&& region->generation == GameLink::SDHR_GetStateGeneration()
+		&& region->failed_count == SDHRSender::Instance().GetFailedCount();
+}
+
+void SDHRUploadAllocator::SetResident(const std::string& name, uint64_t content, size_t length)
+{
+	auto it = regions.find(name);
+	if (it == regions.end())
+		return;
+	it->second.resident = true;
+	it->second.content = content;
+	it->second.length = length;
+	it->second.generation = GameLink::SDHR_GetStateGeneration();
+	it->second.failed_count = SDHRSender::Instance().GetFailedCount();
+}
+
+void SDHRUploadAllocator::Reset()
+{
+	regions.clear();
+	free_runs.clear();
+	free_runs[0] = total_pages;
+	used_pages = 0;
+}
+
+SDHRUploadStats SDHRUploadAllocator::GetStats() const
+{
+	SDHRUploadStats stats;
+	stats.total_pages = total_pages;
+	stats.used_pages = used_pages;
+	stats.free_runs = (uint32_t)free_runs.size();
+	for (auto& run : free_runs)
+		stats.largest_free_run = std::max(stats.largest_free_run, run.second);
+	stats.regions = regions.size();
+	stats.uploads = uploads;
+	stats.uploads_skipped = uploads_skipped;
+	stats.bytes_uploaded = bytes_uploaded;
+	stats.bytes_skipped = bytes_skipped;
+	return stats;
+}
+
+bool SDHRUploadAllocator::TakePages(uint32_t count, uint32_t& first_page)
+{
+	auto best = free_runs.end();
+	for (auto it = free_runs.begin(); it != free_runs.end(); ++it)
+	{
+		if (it->second >= count && (best == free_runs.end() || it->second < best->second))
+		{
+			best = it;
+			if (best->second == count)
+				break;
+		}
+	}
+	if (best == free_runs.end())
+		return false;
+	first_page = best->first;
+	const uint32_t left = best->second - count;
+	free_runs.erase(best);
+	if (left)
+		free_runs[first_page + count] = left;
+	used_pages += count;
+	return true;
+}
+
+void SDHRUploadAllocator::ReturnPages(uint32_t first_page, uint32_t count)
+{
+	used_pages -= count;
+	auto next = free_runs.lower_bound(first_page);
+	if (next != free_runs.end() && first_page + count == next->first)
+	{
+		count += next->second;
+		next = free_runs.erase(next);
+	}
+	if (next != free_runs.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == first_page)
+		{
+			prev->second += count;
+			return;
+		}
+	}
+	free_runs[first_page] = count;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "SDHRCommand.h"
+#include "SDHRHash.h"
+#include <map>
+#include <string>
+
+/**
+ * @brief SDHRUploadAllocator
+ * Hands out named regions of the emulator's upload memory, which commands address as 256-byte pages
+ * through their addr_med/addr_high pair, so that features can share it without clobbering each other.
+ * Free space is kept as a list of page runs, sorted by page and merged with their neighbours when freed.
+ * Allocation is best fit, which keeps the large runs whole for the large regions.
+ * Each region remembers what it holds, so data that's already resident isn't uploaded again,
+ * until the emulator's SDHR state is reset. An upload makes its region resident only once its batch
+ * is published, and like SDHRResidencyCache, every region is forgotten when a publish fails.
+*/
+
+constexpr uint32_t SDHR_UPLOAD_PAGE_SIZE = 256;
+constexpr uint32_t SDHR_UPLOAD_PAGE_COUNT = 65536;	// all a 16-bit page address reaches
+
+struct SDHRUploadRegion
+{
+	uint32_t first_page = 0;
+	uint32_t page_count = 0;
+	uint64_t content = 0;		// hash of what was uploaded, if resident
+	size_t length = 0;			// bytes uploaded
+	bool resident = false;
+	uint32_t generation = 0;	// GameLink::SDHR_GetStateGeneration() when it became resident
+	uint64_t failed_count = 0;	// SDHRSender::GetFailedCount() when it became resident
+
+	uint32_t Address() const { return first_page * SDHR_UPLOAD_PAGE_SIZE; };
+	uint8_t AddrMed() const { return (uint8_t)first_page; };
+	uint8_t AddrHigh() const { return (uint8_t)(first_page >> 8); };
+};
+
+struct SDHRUploadStats
+{
+	uint32_t total_pages = 0;
+	uint32_t used_pages = 0;
+	uint32_t free_runs = 0;
+	uint32_t largest_free_run = 0;	// in pages
+	size_t regions = 0;
+	size_t uploads = 0;				// regions uploaded
+	size_t uploads_skipped = 0;		// regions that already held the data
+	size_t bytes_uploaded = 0;
+	size_t bytes_skipped = 0;
+
+	double Occupancy() const { return total_pages ? (double)used_pages / total_pages : 0; };
+	// 0 when all free pages are in one run, towards 1 as they're scattered in small ones
+	double Fragmentation() const
+	{
+		const uint32_t free_pages = total_pages - used_pages;
+		return free_pages ? 1.0 - (double)largest_free_run / free_pages : 0;
+	};
+};
+
+class SDHRUploadAllocator
+{
+public:
+	SDHRUploadAllocator(uint32_t page_count = SDHR_UPLOAD_PAGE_COUNT);
+
+	// Gives the named region at least enough pages for length bytes. A region that already has the name
+	// is kept if it's big enough, and moved otherwise, losing its contents.
+	// Returns nullptr if there's no run of free pages large enough.
+	const SDHRUploadRegion* Allocate(const std::string& name, size_t length);
+	void Free(const std::string& name);
+	const SDHRUploadRegion* Find(const std::string& name) const;
+
+	// Allocates the region and adds the upload of data into it to the batcher, unless it already holds it.
+	// The region becomes resident when the batcher publishes, see SDHRCommandBatcher::SetResidentOnPublish().
+	// Returns nullptr if the region can't be allocated or the upload can't be added.
+	const SDHRUploadRegion* Upload(SDHRCommandBatcher& batcher, const std::string& name, const uint8_t* data, size_t length);
+
+	// For data that reaches the region some other way, like UploadDataFilenameCmd.
+	// content is anything that identifies the data, like the SDHRHash of the filename,
+	// and length is how many bytes of it there are, compared along with it.
+	bool IsResident(const std::string& name, uint64_t content, size_t length) const;
+	void SetResident(const std::string& name, uint64_t content, size_t length);
+
+	// Frees every region, for when the emulator's SDHR state is reset
+	void Reset();
+
+	SDHRUploadStats GetStats() const;
+
+private:
+	// Takes count pages from the best fitting free run, returns false if there's none
+	bool TakePages(uint32_t count, uint32_t& first_page);
+	// Returns the pages to the free runs, merged with the runs they touch
+	void ReturnPages(uint32_t first_page, uint32_t count);
+
+	uint32_t total_pages;
+	uint32_t used_pages = 0;
+	std::map<uint32_t, uint32_t> free_runs;		// first page -> page count
+	std::map<std::string, SDHRUploadRegion> regions;
+	size_t uploads = 0;
+	size_t uploads_skipped = 0;
+	size_t bytes_uploaded = 0;
+	size_t bytes_skipped = 0;
+};
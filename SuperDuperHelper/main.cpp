@@ -30,9 +30,26 @@
 #include <map>
 
 #include "SDHRCommand.h"
+#include "SDHRScroller.h"
+#include "SDHRUploadAllocator.h"
+#include "SDHRAtlas.h"
+#include "SDHRTrace.h"
+#include "SDHRDisassemblerPanel.h"
+#include "GameLinkInput.h"
 
 std::map<int, bool> keyboard; // Saves the state(true=pressed; false=released) of each SDL_Key.
 
+// Reads a tile map file of exactly length bytes. Fails if it's missing or shorter.
+static bool LoadTileMap(const char* path, std::vector<uint8_t>& tiles, size_t length)
+{
+    std::ifstream f(path, std::ios::in | std::ios::binary);
+    if (!f.is_open())
+        return false;
+    tiles.resize(length);
+    f.read((char*)tiles.data(), (std::streamsize)length);
+    return (size_t)f.gcount() == length;
+}
+
 // Main code
 int main(int, char**)
 {
@@ -126,6 +143,12 @@ int main(int, char**)
 	int my_image_width = 0;
 	int my_image_height = 0;
 	GLuint my_image_texture = 0;
+    // AppleWin's video, uploaded into the same texture every frame
+    ImageHelper::StreamingTexture gamelink_video;
+    // Keys for the emulator, sent once per frame
+    GameLinkInput gamelink_input;
+    // Apple II frames mostly change a few scanlines at a time
+    gamelink_video.SetPartialUpdates(true);
 
     // Our state
     bool show_demo_window = false;
@@ -144,9 +167,34 @@ int main(int, char**)
     // GameLink State
     bool activate_gamelink = false;
 	bool activate_sdhr = false;
-
-    int64_t tile_posx = 560;  // coords of iolo's hut
-    int64_t tile_posy = 832;
+    SDHRPublishStats last_publish;
+    SDHROptimizeStats last_optimize;
+    SDHRCompressStats last_compress;
+    SDHRResidencyStats last_residency;
+    bool compress_payloads = false;
+    bool frame_sync = false;
+    bool record_trace = false;
+    std::string trace_path = "sdhr_trace.bin";
+    int replay_mode = (int)SDHRReplayMode::ORIGINAL_TIMING;
+    SDHRTraceReplayer replayer;
+    bool show_disassembler_window = false;
+    SDHRDisassemblerPanel disassembler;
+    std::future<SDHRPublishStats> pending_publish;
+
+    SDHRUploadAllocator upload_memory;
+    SDHRAtlasBuilder tile_atlas;
+    std::vector<uint8_t> map_tiles;
+    std::array<uint8_t, 2> avatar_tile = { 1, 28 };
+    std::array<uint8_t, 2> atlas_avatar_tile = avatar_tile;    // remapped to the atlas
+    // Packing the tileset in the helper needs an emulator with SDHR_CMD_UPLOAD_DATA_COMPRESSED,
+    // otherwise the emulator loads the sheet itself
+    bool helper_uploads = false;
+    bool atlas_tried = false;
+    std::string setup_status;
+
+    SDHRScroller scroller;
+    scroller.SetPosition(0, 560, 832);  // coords of iolo's hut
+    float scroll_speed = 128.0f;        // pixels per second
 
     // Main loop
     bool done = false;
@@ -177,12 +225,12 @@ int main(int, char**)
 				case SDL_KEYDOWN:
 					keyboard[event.key.keysym.sym] = true;
                     if (GameLink::IsActive())
-                        GameLink::SendKeystroke((UINT)SDL_GetScancodeFromKey(event.key.keysym.sym), true);
+                        gamelink_input.KeyEvent((UINT)SDL_GetScancodeFromKey(event.key.keysym.sym), true);
 					break;
 				case SDL_KEYUP:
 					keyboard[event.key.keysym.sym] = false;
                     if (GameLink::IsActive())
-					    GameLink::SendKeystroke((UINT)SDL_GetScancodeFromKey(event.key.keysym.sym), false);
+					    gamelink_input.KeyEvent((UINT)SDL_GetScancodeFromKey(event.key.keysym.sym), false);
 					break;
 				}
 #pragma warning(pop)
@@ -205,6 +253,12 @@ int main(int, char**)
 
         keyboard.clear();
 
+        // this frame's keys go out in one go, and quick taps over the next frames
+        if (GameLink::IsActive())
+            gamelink_input.Publish();
+        else
+            gamelink_input.Reset();
+
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplSDL2_NewFrame();
@@ -227,7 +281,11 @@ int main(int, char**)
 				if (!GameLink::IsActive() && activate_gamelink)
 					activate_gamelink = GameLink::Init();
                 else if (GameLink::IsActive() && !activate_gamelink)
+                {
+                    replayer.Stop();
+                    SDHRSender::Instance().Stop();
 					GameLink::Destroy();
+                }
                 activate_gamelink = GameLink::IsActive();
             }
 
@@ -249,6 +307,10 @@ int main(int, char**)
 			//	instance_a.OpenDialog("ChooseFileDlgKey", "Choose File", ".png", "./Assets");
 			//}
 
+            ImGui::Checkbox("Compress tile payloads", &compress_payloads);
+            ImGui::Checkbox("Upload assets from the helper", &helper_uploads);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Packs the tileset into an atlas and uploads it with UPLOAD_DATA_COMPRESSED,\nwhich the emulator must support");
             if (ImGui::Button("Define Structs"))
             {
                 //// hacky code used to create data file for britannia map
@@ -259,52 +321,99 @@ int main(int, char**)
                 //}
                 //f.close();
                 auto batcher = SDHRCommandBatcher();
+                batcher.SetOptimize(true);
+                batcher.SetCompress(compress_payloads);
+                batcher.SetDropResident(true);    // only the first setup since a reset uploads the assets
 
                 std::string asset_name = "C:/Users/John/source/repos/SuperDuperHelper/SuperDuperHelper/Assets/Tiles_Ultima5.png";
-                DefineImageAssetFilenameCmd asset_cmd;
-                asset_cmd.asset_index = 0;
-                asset_cmd.filename_length = asset_name.length();
-                asset_cmd.filename = asset_name.c_str();
-                auto assetc = SDHRCommand_DefineImageAssetFilename(&asset_cmd);
-                batcher.AddCommand(&assetc);
-
                 std::string tilefile = "C:/Users/John/source/repos/SuperDuperHelper/SuperDuperHelper/Assets/britannia.dat";
-                UploadDataFilenameCmd upload_tiles;
-                upload_tiles.dest_addr_med = 0;
-                upload_tiles.dest_addr_high = 0;
-                upload_tiles.filename_length = tilefile.length();
-                upload_tiles.filename = tilefile.c_str();
-                auto upload_tiles_cmd = SDHRCommand_UploadDataFilename(&upload_tiles);
-                batcher.AddCommand(&upload_tiles_cmd);
-
-                std::vector<uint16_t> set1_addresses;
-                std::vector<uint16_t> set2_addresses;
-                for (auto i = 0; i < 256; ++i) {
-                    set1_addresses.push_back(i % 32); // x coordinate of tile from PNG
-                    set2_addresses.push_back(i % 32);
-                    set1_addresses.push_back(i / 32); // y coordinate of tile from PNG
-                    set2_addresses.push_back(8 + (i / 32));
+                setup_status.clear();
+                bool use_atlas = false;
+                if (helper_uploads)
+                {
+                    // the sheet's first 256 tiles are tileset 0, the next 256 tileset 1,
+                    // trimmed to the ones the map and the avatar use. Packed once, emitted on every setup.
+                    if (!atlas_tried)
+                    {
+                        atlas_tried = true;
+                        // both tile bytes for each map tile
+                        if (!LoadTileMap(tilefile.c_str(), map_tiles, 256 * 256 * 2))
+                        {
+                            setup_status = "Couldn't read the whole map from britannia.dat";
+                        }
+                        else if (tile_atlas.AddSheetFile(asset_name, 16, 16) < 0)
+                        {
+                            setup_status = "Couldn't load the tile sheet for the atlas";
+                        }
+                        else
+                        {
+                            tile_atlas.SetDedupe(true);
+                            tile_atlas.MarkUsed(map_tiles.data(), map_tiles.size() / 2, 0);
+                            tile_atlas.MarkUsed(avatar_tile.data(), 1, 0);
+                            if (tile_atlas.Pack())
+                            {
+                                tile_atlas.RemapMap(map_tiles.data(), map_tiles.size() / 2, 0);
+                                tile_atlas.RemapMap(atlas_avatar_tile.data(), 1, 0);
+                            }
+                            else
+                            {
+                                setup_status = "Couldn't pack the tileset into an atlas";
+                            }
+                        }
+                    }
+                    if (tile_atlas.GetTilesetCount() > 0)
+                    {
+                        use_atlas = tile_atlas.Emit(batcher, upload_memory, 0, 0);
+                        if (!use_atlas)
+                        {
+                            setup_status = "Couldn't emit the atlas, out of upload memory or indexes";
+                            batcher.Clear();
+                        }
+                    }
+                    if (!use_atlas && setup_status.empty())
+                        setup_status = "The atlas couldn't be made";
+                    if (!use_atlas)
+                        setup_status += ", the emulator loads the sheet instead";
                 }
 
-                DefineTilesetImmediateCmd set1;
-                set1.asset_index = 0;
-                set1.tileset_index = 0;
-                set1.num_entries = 0; // 0 means 256
-                set1.xdim = 16;
-                set1.ydim = 16;
-                set1.data = (uint8_t*)set1_addresses.data();
-                auto set1_cmd = SDHRCommand_DefineTilesetImmediate(&set1);
-                batcher.AddCommand(&set1_cmd);
-
-                DefineTilesetImmediateCmd set2;
-                set2.asset_index = 0;
-                set2.tileset_index = 1;
-                set2.num_entries = 0; // 0 means 256
-                set2.xdim = 16;
-                set2.ydim = 16;
-                set2.data = (uint8_t*)set2_addresses.data();
-                auto set2_cmd = SDHRCommand_DefineTilesetImmediate(&set2);
-                batcher.AddCommand(&set2_cmd);
+                if (!use_atlas)
+                {
+                    DefineImageAssetFilenameCmd asset_cmd;
+                    asset_cmd.asset_index = 0;
+                    asset_cmd.filename_length = asset_name.length();
+                    asset_cmd.filename = asset_name.c_str();
+                    auto assetc = SDHRCommand_DefineImageAssetFilename(&asset_cmd);
+                    batcher.AddCommand(&assetc);
+
+                    std::vector<uint16_t> set1_addresses;
+                    std::vector<uint16_t> set2_addresses;
+                    for (auto i = 0; i < 256; ++i) {
+                        set1_addresses.push_back(i % 32); // x coordinate of tile from PNG
+                        set2_addresses.push_back(i % 32);
+                        set1_addresses.push_back(i / 32); // y coordinate of tile from PNG
+                        set2_addresses.push_back(8 + (i / 32));
+                    }
+
+                    DefineTilesetImmediateCmd set1;
+                    set1.asset_index = 0;
+                    set1.tileset_index = 0;
+                    set1.num_entries = 0; // 0 means 256
+                    set1.xdim = 16;
+                    set1.ydim = 16;
+                    set1.data = (uint8_t*)set1_addresses.data();
+                    auto set1_cmd = SDHRCommand_DefineTilesetImmediate(&set1);
+                    batcher.AddCommand(&set1_cmd);
+
+                    DefineTilesetImmediateCmd set2;
+                    set2.asset_index = 0;
+                    set2.tileset_index = 1;
+                    set2.num_entries = 0; // 0 means 256
+                    set2.xdim = 16;
+                    set2.ydim = 16;
+                    set2.data = (uint8_t*)set2_addresses.data();
+                    auto set2_cmd = SDHRCommand_DefineTilesetImmediate(&set2);
+                    batcher.AddCommand(&set2_cmd);
+                }
 
                 DefineWindowCmd w;
                 w.window_index = 0;
@@ -313,10 +422,10 @@ int main(int, char**)
                 w.screen_ycount = 336;
                 w.screen_xbegin = 0;
                 w.screen_ybegin = 0;
-                w.tile_xbegin = tile_posx;
-                w.tile_ybegin = tile_posy;
-                w.tile_xdim = set1.xdim;
-                w.tile_ydim = set1.ydim;
+                w.tile_xbegin = scroller.GetX(0);
+                w.tile_ybegin = scroller.GetY(0);
+                w.tile_xdim = 16;
+                w.tile_ydim = 16;
                 w.tile_xcount = 256;
                 w.tile_ycount = 256;
                 auto w_cmd = SDHRCommand_DefineWindow(&w);
@@ -331,34 +440,43 @@ int main(int, char**)
                 w2.screen_ybegin = 160;
                 w2.tile_xbegin = 0;
                 w2.tile_ybegin = 0;
-                w2.tile_xdim = set2.xdim;
-                w2.tile_ydim = set2.ydim;
+                w2.tile_xdim = 16;
+                w2.tile_ydim = 16;
                 w2.tile_xcount = 1;
                 w2.tile_ycount = 1;
                 auto w2_cmd = SDHRCommand_DefineWindow(&w2);
                 batcher.AddCommand(&w2_cmd);
 
-                UpdateWindowSetUploadCmd set_tiles;
-                set_tiles.window_index = 0;
-                set_tiles.tile_xbegin = 0;
-                set_tiles.tile_ybegin = 0;
-                set_tiles.tile_xcount = w.tile_xcount;
-                set_tiles.tile_ycount = w.tile_ycount;
-                set_tiles.upload_addr_med = 0;
-                set_tiles.upload_addr_high = 0;
-                auto set_tiles_cmd = SDHRCommand_UpdateWindowSetUpload(&set_tiles);
-                batcher.AddCommand(&set_tiles_cmd);
-
-                std::array<uint8_t, 2> avatar_tile = { 1, 28 };
-                UpdateWindowSetBothCmd set_tiles2;
-                set_tiles2.window_index = 1;
-                set_tiles2.tile_xbegin = 0;
-                set_tiles2.tile_ybegin = 0;
-                set_tiles2.tile_xcount = 1;
-                set_tiles2.tile_ycount = 1;
-                set_tiles2.data = avatar_tile.data();
-                auto set_tiles2_cmd = SDHRCommand_UpdateWindowSetBoth(&set_tiles2);
-                batcher.AddCommand(&set_tiles2_cmd);
+                if (use_atlas)
+                {
+                    // the map goes up once as an upload, and stays there until a reset
+                    batcher.SetTiles(0, 0, 0, w.tile_xcount, w.tile_ycount, map_tiles.data(), &upload_memory, "britannia");
+                    batcher.SetTiles(1, 0, 0, 1, 1, atlas_avatar_tile.data());
+                }
+                else
+                {
+                    // the emulator reads the map itself, and needs no compressed uploads for it
+                    UploadDataFilenameCmd upload_tiles;
+                    upload_tiles.dest_addr_med = 0;
+                    upload_tiles.dest_addr_high = 0;
+                    upload_tiles.filename_length = tilefile.length();
+                    upload_tiles.filename = tilefile.c_str();
+                    auto upload_tiles_cmd = SDHRCommand_UploadDataFilename(&upload_tiles);
+                    batcher.AddCommand(&upload_tiles_cmd);
+
+                    UpdateWindowSetUploadCmd set_tiles;
+                    set_tiles.window_index = 0;
+                    set_tiles.tile_xbegin = 0;
+                    set_tiles.tile_ybegin = 0;
+                    set_tiles.tile_xcount = w.tile_xcount;
+                    set_tiles.tile_ycount = w.tile_ycount;
+                    set_tiles.upload_addr_med = 0;
+                    set_tiles.upload_addr_high = 0;
+                    auto set_tiles_cmd = SDHRCommand_UpdateWindowSetUpload(&set_tiles);
+                    batcher.AddCommand(&set_tiles_cmd);
+
+                    batcher.SetTiles(1, 0, 0, 1, 1, avatar_tile.data());
+                }
 
                 UpdateWindowEnableCmd w_enable;
                 w_enable.window_index = 0;
@@ -372,13 +490,15 @@ int main(int, char**)
                 auto w_enable2_cmd = SDHRCommand_UpdateWindowEnable(&w_enable2);
                 batcher.AddCommand(&w_enable2_cmd);
 
-                batcher.Publish();
+                pending_publish = batcher.Publish();
+                scroller.SetPosition(0, w.tile_xbegin, w.tile_ybegin);
+                last_optimize = batcher.GetLastOptimizeStats();
+                last_compress = batcher.GetCompressStats();
+                last_residency = batcher.GetLastResidencyStats();
             }
+            if (!setup_status.empty())
+                ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f), "%s", setup_status.c_str());
 
-            UpdateWindowAdjustWindowViewCmd scWP;
-            scWP.window_index = 0;
-            scWP.tile_xbegin = tile_posx;
-            scWP.tile_ybegin = tile_posy;
 			//ImGui::SeparatorText("North");
 			//static int tile_pos_abs_h = tile_posx;
    //         if (ImGui::SliderInt("Move North", &tile_pos_abs_h, 0, 255))
@@ -404,53 +524,96 @@ int main(int, char**)
 			//	batcher.Publish();
 			//}
 
+            ImGui::SliderFloat("Scroll speed (pixels/s)", &scroll_speed, 16.0f, 1024.0f);
             if (ImGui::Button("North"))
+                scroller.MoveBy(0, 0, -16, scroll_speed);
+            if (ImGui::Button("South"))
+                scroller.MoveBy(0, 0, 16, scroll_speed);
+            if (ImGui::Button("East"))
+                scroller.MoveBy(0, 16, 0, scroll_speed);
+            if (ImGui::Button("West"))
+                scroller.MoveBy(0, -16, 0, scroll_speed);
+            scroller.Update();
+            ImGui::Text("View: %lld, %lld%s", (long long)scroller.GetX(0), (long long)scroller.GetY(0), scroller.IsMoving(0) ? " (moving)" : "");
+            ImGui::Text("View publishes: %llu, %llu of them patched in place",
+                (unsigned long long)scroller.GetPublishCount(), (unsigned long long)scroller.GetPreparedPublishCount());
+
+			if (ImGui::Button("Reset"))
+			{
+				GameLink::SDHR_reset();
+				upload_memory.Reset();
+			}
+
+            if (ImGui::Checkbox("Sync publishes to emulator frames", &frame_sync))
             {
-                for (auto i = 0; i < 8; ++i) {
-                    auto batcher = SDHRCommandBatcher();
-                    tile_posy -= 2;
-                    scWP.tile_ybegin = tile_posy;
-                    auto c1 = SDHRCommand_UpdateWindowAdjustWindowView(&scWP);
-                    batcher.AddCommand(&c1);
-                    batcher.Publish();
-                }
+                SDHRSender::Instance().SetFrameSync(frame_sync);
+                SDHRSender::Instance().ResetFrameStats();
             }
-            if (ImGui::Button("South"))
+
+            if (pending_publish.valid() && pending_publish.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                last_publish = pending_publish.get();
+            ImGui::Text("Last publish: %zu bytes, %zu commands in %zu chunks, %.2f MB/s",
+                last_publish.bytes, last_publish.commands, last_publish.chunks, last_publish.MegabytesPerSecond());
+            ImGui::Text("Last optimize: %zu commands removed, %zu bytes saved", last_optimize.commands_removed, last_optimize.bytes_saved);
+            ImGui::Text("Last compress: %zu of %zu payloads compressed, %zu to %zu bytes (%.2fx)", last_compress.payloads_compressed,
+                last_compress.payloads_compressed + last_compress.payloads_raw, last_compress.raw_bytes, last_compress.encoded_bytes, last_compress.Ratio());
+            ImGui::Text("Last setup: %zu commands already resident, %zu bytes saved", last_residency.commands_dropped, last_residency.bytes_dropped);
+            SDHRUploadStats us = upload_memory.GetStats();
+            ImGui::Text("Upload memory: %zu regions, %.1f%% used, %.1f%% fragmented, %zu uploads, %zu skipped as resident",
+                us.regions, us.Occupancy() * 100.0, us.Fragmentation() * 100.0, us.uploads, us.uploads_skipped);
+            ImGui::Text("Sender queue: %zu pending, %llu sent, %llu failed", SDHRSender::Instance().GetQueueDepth(),
+                (unsigned long long)SDHRSender::Instance().GetCompletedCount(), (unsigned long long)SDHRSender::Instance().GetFailedCount());
+            if (GameLink::GetCommandRingSlots() > 0)
+                ImGui::Text("Command channel: ring of %u slots", GameLink::GetCommandRingSlots());
+            else
+                ImGui::Text("Command channel: single buffer");
+            GameLink::sWriteStats ws = GameLink::GetWriteStats();
+            ImGui::Text("Writes: %llu, %llu waited for room (%llu spun), mean wait %.0f us, max %.0f us, %llu timed out",
+                (unsigned long long)ws.writes, (unsigned long long)ws.waits, (unsigned long long)ws.spin_waits,
+                ws.MeanWaitSeconds() * 1e6, ws.max_wait_seconds * 1e6, (unsigned long long)ws.timeouts);
+            const GameLinkInputStats& is = gamelink_input.GetStats();
+            ImGui::Text("Keyboard: %zu key events, %zu states sent, %zu waiting, %zu put off by a busy mutex, %zu merged",
+                is.events, is.publishes, gamelink_input.GetPendingCount(), is.lock_misses, is.merged);
+            if (frame_sync)
             {
-                for (auto i = 0; i < 8; ++i) {
-                    auto batcher = SDHRCommandBatcher();
-                    tile_posy += 2;
-                    scWP.tile_ybegin = tile_posy;
-                    auto c1 = SDHRCommand_UpdateWindowAdjustWindowView(&scWP);
-                    batcher.AddCommand(&c1);
-                    batcher.Publish();
-                }
+                SDHRFrameStats fs = SDHRSender::Instance().GetFrameStats();
+                ImGui::Text("Frames: %llu published, %llu missed, %llu late, %llu coalesced, release %.2f ms avg %.2f ms max",
+                    (unsigned long long)fs.frames_published, (unsigned long long)fs.missed_frames, (unsigned long long)fs.late_publishes,
+                    (unsigned long long)fs.coalesced, fs.MeanReleaseSeconds() * 1000.0, fs.max_release_seconds * 1000.0);
             }
-            if (ImGui::Button("East"))
+
+            ImGui::SeparatorText("SDHR Trace");
+            ImGui::InputText("Trace file", &trace_path);
+            if (ImGui::Checkbox("Record published batches", &record_trace))
             {
-                for (auto i = 0; i < 8; ++i) {
-                    auto batcher = SDHRCommandBatcher();
-                    tile_posx += 2;
-                    scWP.tile_xbegin = tile_posx;
-                    auto c1 = SDHRCommand_UpdateWindowAdjustWindowView(&scWP);
-                    batcher.AddCommand(&c1);
-                    batcher.Publish();
-                }
+                if (record_trace)
+                    record_trace = SDHRTraceRecorder::Instance().Start(trace_path);
+                else
+                    SDHRTraceRecorder::Instance().Stop();
             }
-            if (ImGui::Button("West"))
+            if (record_trace)
+                ImGui::Text("Recorded %zu batches, %llu bytes", SDHRTraceRecorder::Instance().GetRecordCount(),
+                    (unsigned long long)SDHRTraceRecorder::Instance().GetBytes());
+            if (ImGui::Button("Disassembler"))
             {
-                for (auto i = 0; i < 8; ++i) {
-                    auto batcher = SDHRCommandBatcher();
-                    tile_posx -= 2;
-                    scWP.tile_xbegin = tile_posx;
-                    auto c1 = SDHRCommand_UpdateWindowAdjustWindowView(&scWP);
-                    batcher.AddCommand(&c1);
-                    batcher.Publish();
-                }
+                disassembler.SetTracePath(trace_path);
+                show_disassembler_window = true;
+            }
+            ImGui::Combo("Replay timing", &replay_mode, "Original timing\0As fast as possible\0Frame-locked\0");
+            if (!replayer.IsRunning())
+            {
+                if (ImGui::Button("Replay trace") && !record_trace)
+                    replayer.Start(trace_path, (SDHRReplayMode)replay_mode);
+            }
+            else if (ImGui::Button("Stop replay"))
+                replayer.Stop();
+            {
+                SDHRReplayStats rs = replayer.GetStats();
+                ImGui::Text("Replayed %zu/%zu batches (%zu failed), %zu bytes in %.2f s, %.2f MB/s", rs.records, replayer.GetRecordCount(),
+                    rs.failed, rs.bytes, rs.seconds, rs.MegabytesPerSecond());
+                ImGui::Text("Write latency %.3f/%.3f/%.3f ms min/avg/max, %.3f ms late at most", rs.min_write_seconds * 1000.0,
+                    rs.MeanWriteSeconds() * 1000.0, rs.max_write_seconds * 1000.0, rs.max_late_seconds * 1000.0);
             }
-
-			if (ImGui::Button("Reset"))
-				GameLink::SDHR_reset();
 
 			if (!activate_gamelink)
 				ImGui::EndDisabled();
@@ -488,6 +651,9 @@ int main(int, char**)
             ImGui::End();
         }
 
+        if (show_disassembler_window)
+            disassembler.Draw("SDHR Disassembler", &show_disassembler_window);
+
         // 3. Show another simple window.
         if (show_another_window)
         {
@@ -516,18 +682,31 @@ int main(int, char**)
         {
             // Load video
             auto fbI = GameLink::GetFrameBufferInfo();
-            GLuint gamelink_video_texture = 0;
-            bool ret = ImageHelper::LoadTextureFromMemory(fbI.frameBuffer, &gamelink_video_texture, fbI.width, fbI.height, true);
+            // the emulator usually makes fewer frames than we draw, so most need no upload
+            if (fbI.bufferLength > 0)
+                gamelink_video.UpdateFrame(fbI.seq, fbI.frameBuffer, fbI.width, fbI.height, true);
             ImVec2 vpos = ImVec2(300.f, 300.f);
             ImGui::SetNextWindowPos(vpos, ImGuiCond_FirstUseEver);
             ImGui::Begin("AppleWin Video", &show_gamelink_video_window);
-            ImGui::Text("size = %d x %d", fbI.width, fbI.height);
-            ImGui::Image((void*)(intptr_t)gamelink_video_texture, ImVec2(fbI.width, fbI.height), ImVec2(0, 1), ImVec2(1, 0));
+            const ImageHelper::StreamingTextureStats& vs = gamelink_video.GetStats();
+            ImGui::Text("size = %d x %d, %zu frames uploaded, %zu skipped as unchanged, %zu reallocations", fbI.width, fbI.height,
+                vs.uploads, vs.skipped, vs.reallocations);
+            ImGui::Text("%zu partial uploads, %zu clean frames, %zu bytes changed in %.3f ms last frame", vs.partial_uploads, vs.clean_frames,
+                vs.last_changed_bytes, vs.last_upload_seconds * 1000.0);
+            const GameLink::sFrameStats fs = GameLink::GetFrameStats();
+            ImGui::Text("Frame handoff: %s, %llu copied, %llu torn, %llu kept the previous frame",
+                GameLink::HasFrameBuffers() ? "lock-free buffers" : "single frame",
+                (unsigned long long)fs.copies, (unsigned long long)fs.torn, (unsigned long long)fs.gave_up);
+            ImGui::Image((void*)(intptr_t)gamelink_video.GetTexture(), ImVec2(gamelink_video.GetWidth(), gamelink_video.GetHeight()), ImVec2(0, 1), ImVec2(1, 0));
             is_gamelink_focused = ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows);
             ImGui::End();
         }
         else
+        {
             is_gamelink_focused = false;
+            // the sequence may come around to the same number by the time it's back
+            gamelink_video.ForgetFrame();
+        }
 
         // Rendering
         ImGui::Render();
@@ -542,8 +721,12 @@ int main(int, char**)
 #endif
 
     // Cleanup
+    replayer.Stop();
+    SDHRTraceRecorder::Instance().Stop();
+    SDHRSender::Instance().Stop();
     if (GameLink::IsActive())
         GameLink::Destroy();
+    gamelink_video.Release();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();